@@ -5,7 +5,7 @@ out vec4 color_out;
 in vec3 in_position;
 in vec3 position, normal;
 
-uniform vec3 camera_position;
+uniform vec3 camera_position, light_position;
 uniform vec3 albedo;
 uniform samplerCube cube;
 
@@ -32,7 +32,7 @@ float brdf(float n_dot_h, float n_dot_v, float n_dot_l, float roughness, float f
 }
 
 void main() {
-    vec3 light = vec3(2.0, 0.5, -2.0);
+    vec3 light = light_position;
     float light_power = 20;
 
     vec3 eye = normalize(camera_position - position);
@@ -4,6 +4,7 @@ layout(location = 0) in vec3 v_position;
 layout(location = 1) in vec3 v_normal;
 
 uniform mat4 transform, world;
+uniform mat3 normal_matrix;
 
 out vec3 in_position;
 out vec3 position, normal;
@@ -14,5 +15,5 @@ void main() {
 
     in_position = v_position;
     position = v.xyz;
-    normal = (world * vec4(v_normal, 0.0f)).xyz;
+    normal = normalize(normal_matrix * v_normal);
 }
@@ -9,7 +9,7 @@ out vec3 position, normal;
 
 void main() {
     vec4 v = world * vec4(v_position, 1.0f);
-    gl_Position = transform * v;
+    gl_Position = (transform * v).xyww; // at the far plane, behind everything
 
     position = v.xyz;
     normal = (world * vec4(v_normal, 0.0f)).xyz;
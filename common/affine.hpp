@@ -0,0 +1,187 @@
+#pragma once
+#include <array>
+#include <type_traits>
+#include "simd.hpp"
+#include "vector.hpp"
+#include "matrix.hpp"
+#include "quaternion.hpp"
+
+// An affine transform, stored as the top three rows of a mat4 (the bottom row is
+// always 0, 0, 0, 1). Composing two costs 36 multiplies instead of 64, and the
+// inverse of a rigid transform is a transpose. Convert with to_mat4() for upload.
+template <class T>
+class alignas(sizeof(T) * 4 < 16 ? sizeof(T) * 4 : 16) affine {
+public:
+    std::array<T, 12> data;
+
+    explicit affine(uninitialized_t) { }
+
+    // The identity transform.
+    constexpr affine() : data{{ 1, 0, 0, 0, 0, 1, 0, 0, 0, 0, 1, 0 }} { }
+
+    // Every element of the top three rows, in row-major order.
+    constexpr explicit affine(const std::array<T, 12>& data) : data(data) { }
+
+    // The top three rows of m, which must itself be affine (look_at, translate, ...).
+    explicit affine(const matrix<T, 4, 4>& m) {
+        for (int i = 0; i < 12; ++i) {
+            data[i] = m.data[i];
+        }
+    }
+
+    affine(const matrix<T, 3, 3>& linear, const vector<T, 3>& translation) {
+        for (int row = 0; row < 3; ++row) {
+            for (int col = 0; col < 3; ++col) {
+                at(row, col) = linear(row, col);
+            }
+            at(row, 3) = translation.data[row];
+        }
+    }
+
+    // Scale, then rotate, then translate.
+    affine(const vector<T, 3>& translation, const quaternion<T>& rotation, const vector<T, 3>& scale = vector<T, 3>(1)) {
+        matrix<T, 3, 3> r = rotation.to_mat3();
+        for (int row = 0; row < 3; ++row) {
+            for (int col = 0; col < 3; ++col) {
+                at(row, col) = r(row, col) * scale.data[col];
+            }
+            at(row, 3) = translation.data[row];
+        }
+    }
+
+    T& at(int row, int col) {
+        return data[col + row * 4];
+    }
+
+    constexpr const T& at(int row, int col) const {
+        return data[col + row * 4];
+    }
+
+    T& operator()(int row, int col) {
+        return at(row, col);
+    }
+
+    constexpr const T& operator()(int row, int col) const {
+        return at(row, col);
+    }
+
+    matrix<T, 3, 3> linear() const {
+        return matrix<T, 3, 3>(std::array<T, 9>{{
+            at(0, 0), at(0, 1), at(0, 2),
+            at(1, 0), at(1, 1), at(1, 2),
+            at(2, 0), at(2, 1), at(2, 2)
+        }});
+    }
+
+    vector<T, 3> translation() const {
+        return vector<T, 3>{ at(0, 3), at(1, 3), at(2, 3) };
+    }
+
+    matrix<T, 4, 4> to_mat4() const {
+        matrix<T, 4, 4> m;
+        for (int i = 0; i < 12; ++i) {
+            m.data[i] = data[i];
+        }
+        return m;
+    }
+
+
+    affine& operator*=(const affine& other) {
+        affine result(uninitialized);
+        for (int row = 0; row < 3; ++row) {
+            for (int col = 0; col < 4; ++col) {
+                result(row, col) = at(row, 0) * other(0, col) + at(row, 1) * other(1, col) + at(row, 2) * other(2, col);
+            }
+            result(row, 3) += at(row, 3);
+        }
+
+        *this = result;
+        return *this;
+    }
+
+    affine operator*(const affine& other) const {
+        affine result = *this;
+        return result *= other;
+    }
+
+    vector<T, 3> transform_point(const vector<T, 3>& p) const {
+        return vector<T, 3>{
+            at(0, 0) * p.x + at(0, 1) * p.y + at(0, 2) * p.z + at(0, 3),
+            at(1, 0) * p.x + at(1, 1) * p.y + at(1, 2) * p.z + at(1, 3),
+            at(2, 0) * p.x + at(2, 1) * p.y + at(2, 2) * p.z + at(2, 3)
+        };
+    }
+
+    vector<T, 3> transform_direction(const vector<T, 3>& d) const {
+        return vector<T, 3>{
+            at(0, 0) * d.x + at(0, 1) * d.y + at(0, 2) * d.z,
+            at(1, 0) * d.x + at(1, 1) * d.y + at(1, 2) * d.z,
+            at(2, 0) * d.x + at(2, 1) * d.y + at(2, 2) * d.z
+        };
+    }
+
+
+    // Inverse of a rotation plus translation (no scale or shear): the transposed
+    // rotation and the translation rotated back and negated.
+    affine inverse_rigid() const {
+        vector<T, 3> t = translation();
+        return affine(std::array<T, 12>{{
+            at(0, 0), at(1, 0), at(2, 0), -(at(0, 0) * t.x + at(1, 0) * t.y + at(2, 0) * t.z),
+            at(0, 1), at(1, 1), at(2, 1), -(at(0, 1) * t.x + at(1, 1) * t.y + at(2, 1) * t.z),
+            at(0, 2), at(1, 2), at(2, 2), -(at(0, 2) * t.x + at(1, 2) * t.y + at(2, 2) * t.z)
+        }});
+    }
+
+    // Inverse of any invertible affine transform, including scale and shear.
+    affine inverse() const {
+        matrix<T, 3, 3> l = ::inverse(linear());
+        affine result(uninitialized);
+        for (int row = 0; row < 3; ++row) {
+            result(row, 0) = l(row, 0);
+            result(row, 1) = l(row, 1);
+            result(row, 2) = l(row, 2);
+            result(row, 3) = -(l(row, 0) * at(0, 3) + l(row, 1) * at(1, 3) + l(row, 2) * at(2, 3));
+        }
+        return result;
+    }
+
+    // The matrix that carries normals through this transform; equal to linear()
+    // when there is no non-uniform scale.
+    matrix<T, 3, 3> normal_matrix() const {
+        return ::inverse_transpose(linear());
+    }
+};
+
+
+#if defined(SIMD_SSE2)
+
+// Each row of the result is a sum of the other's rows weighted by this row, with
+// this row's translation added on to the last lane.
+template <>
+inline affine<float>& affine<float>::operator*=(const affine& other) {
+    const float* b = other.data.data();
+    simd::float4 b0 = simd::load(b), b1 = simd::load(b + 4), b2 = simd::load(b + 8);
+    simd::float4 w = simd::set(0, 0, 0, 1);
+    for (int row = 0; row < 3; ++row) {
+        simd::float4 a = simd::load(&data[row * 4]);
+        simd::float4 r = simd::splat<0>(a) * b0 + simd::splat<1>(a) * b1 + simd::splat<2>(a) * b2 + a * w;
+        simd::store(&data[row * 4], r);
+    }
+    return *this;
+}
+
+#endif
+
+
+typedef affine<float> affine3;
+
+static_assert(sizeof(affine3) == 48 && alignof(affine3) == 16, "affine3 rows must be SIMD registers");
+static_assert(std::is_trivially_copyable<affine3>::value, "affine3 must be trivially copyable");
+
+
+// out[i] = m * in[i] for count transforms, e.g. parent * local[i]. in and out may be the same array.
+static void multiply(const affine3& m, const affine3* in, affine3* out, int count) {
+    for (int i = 0; i < count; ++i) {
+        out[i] = m * in[i];
+    }
+}
@@ -0,0 +1,323 @@
+#pragma once
+#include <limits>
+#include <type_traits>
+#include "simd.hpp"
+#include "vector.hpp"
+#include "matrix.hpp"
+#include "affine.hpp"
+
+// Bounding volumes and the tests between them. All of these are plain aggregates
+// so arrays of them can be streamed through the batch tests at the bottom.
+
+// The points p with normal.dot(p) + d == 0. Positive distances are in front.
+struct plane {
+    vec3 normal;
+    float d;
+
+    float distance(const vec3& p) const {
+        return normal.x * p.x + normal.y * p.y + normal.z * p.z + d;
+    }
+
+    plane normalized() const {
+        float l = normal.length();
+        return plane{ normal / l, d / l };
+    }
+
+    static plane from_point_normal(const vec3& point, const vec3& normal) {
+        return plane{ normal, -normal.dot(point) };
+    }
+};
+
+struct sphere {
+    vec3 center;
+    float radius;
+
+    bool contains(const vec3& p) const {
+        return (p - center).lengthSquared() <= radius * radius;
+    }
+
+    bool intersects(const sphere& s) const {
+        float r = radius + s.radius;
+        return (s.center - center).lengthSquared() <= r * r;
+    }
+};
+
+struct aabb {
+    vec3 min, max;
+
+    // An inverted box that any point or box merged into replaces.
+    static aabb empty() {
+        float inf = std::numeric_limits<float>::infinity();
+        return aabb{ vec3(inf), vec3(-inf) };
+    }
+
+    // True for empty(), and any box merged with nothing since.
+    bool is_empty() const {
+        return min.x > max.x;
+    }
+
+    vec3 center() const {
+        return (min + max) * 0.5f;
+    }
+
+    vec3 extents() const {
+        return (max - min) * 0.5f;
+    }
+
+    void merge(const vec3& p) {
+        min = vec3{ std::min(min.x, p.x), std::min(min.y, p.y), std::min(min.z, p.z) };
+        max = vec3{ std::max(max.x, p.x), std::max(max.y, p.y), std::max(max.z, p.z) };
+    }
+
+    void merge(const aabb& b) {
+        merge(b.min);
+        merge(b.max);
+    }
+
+    bool contains(const vec3& p) const {
+        return p.x >= min.x && p.x <= max.x && p.y >= min.y && p.y <= max.y && p.z >= min.z && p.z <= max.z;
+    }
+
+    bool intersects(const aabb& b) const {
+        return min.x <= b.max.x && max.x >= b.min.x && min.y <= b.max.y && max.y >= b.min.y && min.z <= b.max.z && max.z >= b.min.z;
+    }
+
+    bool intersects(const sphere& s) const {
+        vec3 p{ clamp(s.center.x, min.x, max.x), clamp(s.center.y, min.y, max.y), clamp(s.center.z, min.z, max.z) };
+        return (p - s.center).lengthSquared() <= s.radius * s.radius;
+    }
+
+    // The box around this one after it has been through m.
+    aabb transformed(const affine3& m) const {
+        vec3 c = m.transform_point(center()), e = extents();
+        vec3 r{
+            std::fabs(m(0, 0)) * e.x + std::fabs(m(0, 1)) * e.y + std::fabs(m(0, 2)) * e.z,
+            std::fabs(m(1, 0)) * e.x + std::fabs(m(1, 1)) * e.y + std::fabs(m(1, 2)) * e.z,
+            std::fabs(m(2, 0)) * e.x + std::fabs(m(2, 1)) * e.y + std::fabs(m(2, 2)) * e.z
+        };
+        return aabb{ c - r, c + r };
+    }
+
+private:
+    static float clamp(float x, float lo, float hi) {
+        return x < lo ? lo : x > hi ? hi : x;
+    }
+};
+
+struct ray {
+    vec3 origin, direction;
+
+    vec3 at(float t) const {
+        return origin + direction * t;
+    }
+
+    // Slab test. On a hit t is the entry distance, or 0 when the origin is inside.
+    bool intersects(const aabb& b, float& t, float max_distance = std::numeric_limits<float>::infinity()) const {
+        float t0 = 0.0f, t1 = max_distance;
+        for (int i = 0; i < 3; ++i) {
+            float inv = 1.0f / direction.data[i];
+            float a = (b.min.data[i] - origin.data[i]) * inv;
+            float c = (b.max.data[i] - origin.data[i]) * inv;
+            t0 = std::max(t0, std::min(a, c));
+            t1 = std::min(t1, std::max(a, c));
+        }
+        t = t0;
+        return t0 <= t1;
+    }
+
+    // direction must be normalized.
+    bool intersects(const sphere& s, float& t) const {
+        vec3 m = origin - s.center;
+        float b = m.dot(direction), c = m.lengthSquared() - s.radius * s.radius;
+        float disc = b * b - c;
+        if ((c > 0.0f && b > 0.0f) || disc < 0.0f) {
+            return false;
+        }
+        t = std::max(0.0f, -b - std::sqrt(disc));
+        return true;
+    }
+};
+
+// Six inward facing planes: left, right, bottom, top, near, far.
+struct frustum {
+    plane planes[6];
+
+    // Extracts the planes from the rows of a view-projection matrix. Uses OpenGL's
+    // -w <= z <= w depth range, which for perspective()'s 0 <= z <= w puts the near
+    // plane slightly behind the real one; culling stays conservative.
+    static frustum from_matrix(const mat4& m) {
+        vec4 r0{ m(0, 0), m(0, 1), m(0, 2), m(0, 3) };
+        vec4 r1{ m(1, 0), m(1, 1), m(1, 2), m(1, 3) };
+        vec4 r2{ m(2, 0), m(2, 1), m(2, 2), m(2, 3) };
+        vec4 r3{ m(3, 0), m(3, 1), m(3, 2), m(3, 3) };
+        vec4 p[6] = { r3 + r0, r3 - r0, r3 + r1, r3 - r1, r3 + r2, r3 - r2 };
+
+        frustum f;
+        for (int i = 0; i < 6; ++i) {
+            f.planes[i] = plane{ vec3{ p[i].x, p[i].y, p[i].z }, p[i].w };
+            // An infinite far plane comes out as 0, 0, 0, d > 0, which everything is in front of.
+            if (f.planes[i].normal.lengthSquared() > 0.0f) {
+                f.planes[i] = f.planes[i].normalized();
+            }
+        }
+        return f;
+    }
+
+    bool contains(const vec3& p) const {
+        for (const plane& pl : planes) {
+            if (pl.distance(p) < 0.0f) {
+                return false;
+            }
+        }
+        return true;
+    }
+
+    bool intersects(const sphere& s) const {
+        for (const plane& pl : planes) {
+            if (pl.distance(s.center) < -s.radius) {
+                return false;
+            }
+        }
+        return true;
+    }
+
+    // Conservative: boxes near a frustum corner may pass without intersecting.
+    bool intersects(const aabb& b) const {
+        vec3 c = b.center(), e = b.extents();
+        for (const plane& pl : planes) {
+            float r = std::fabs(pl.normal.x) * e.x + std::fabs(pl.normal.y) * e.y + std::fabs(pl.normal.z) * e.z;
+            if (pl.distance(c) < -r) {
+                return false;
+            }
+        }
+        return true;
+    }
+};
+
+static_assert(sizeof(sphere) == 16 && sizeof(aabb) == 24, "volumes must pack tightly for the batch tests");
+static_assert(std::is_trivially_copyable<aabb>::value && std::is_trivially_copyable<frustum>::value, "volumes must be trivially copyable");
+
+
+namespace bounds_simd {
+
+    // Writes base + j for each set bit j of m into out, without branching. out
+    // needs room for a full register of indices. Returns the number written.
+    inline int compact(int m, int base, int* out) {
+        int n = 0;
+        for (int j = 0; j < simd::lanes; ++j) {
+            out[n] = base + j;
+            n += (m >> j) & 1;
+        }
+        return n;
+    }
+
+    // The planes of a frustum broadcast across registers.
+    struct planes {
+        simd::floatv nx[6], ny[6], nz[6], ax[6], ay[6], az[6], d[6];
+
+        explicit planes(const frustum& f) {
+            for (int i = 0; i < 6; ++i) {
+                const plane& p = f.planes[i];
+                nx[i] = simd::setv(p.normal.x);
+                ny[i] = simd::setv(p.normal.y);
+                nz[i] = simd::setv(p.normal.z);
+                ax[i] = simd::setv(std::fabs(p.normal.x));
+                ay[i] = simd::setv(std::fabs(p.normal.y));
+                az[i] = simd::setv(std::fabs(p.normal.z));
+                d[i] = simd::setv(p.d);
+            }
+        }
+    };
+
+    // simd::lanes boxes from p (6 floats each) as centers and extents.
+    inline void load_boxes(const float* p, simd::floatv& cx, simd::floatv& cy, simd::floatv& cz, simd::floatv& ex, simd::floatv& ey, simd::floatv& ez) {
+        simd::floatv ax, ay, az, bx, by, bz, min_x, min_y, min_z, max_x, max_y, max_z;
+        simd::load_xyz(p, ax, ay, az);
+        simd::load_xyz(p + simd::lanes * 3, bx, by, bz);
+        simd::deinterleave(ax, bx, min_x, max_x);
+        simd::deinterleave(ay, by, min_y, max_y);
+        simd::deinterleave(az, bz, min_z, max_z);
+
+        simd::floatv half = simd::setv(0.5f);
+        cx = (min_x + max_x) * half;
+        cy = (min_y + max_y) * half;
+        cz = (min_z + max_z) * half;
+        ex = (max_x - min_x) * half;
+        ey = (max_y - min_y) * half;
+        ez = (max_z - min_z) * half;
+    }
+}
+
+// Batch tests over contiguous arrays, simd::lanes volumes per iteration. Each
+// writes the indices of the volumes that pass into out, in order, and returns how
+// many there were; out must have room for count indices.
+static int cull_spheres(const frustum& f, const sphere* spheres, int count, int* out) {
+    bounds_simd::planes pl(f);
+    const float* p = &spheres->center.x;
+    int n = 0, i = 0;
+    for (; i + simd::lanes <= count; i += simd::lanes, p += simd::lanes * 4) {
+        simd::floatv x, y, z, r;
+        simd::load_xyzw(p, x, y, z, r);
+        simd::floatv nr = -r;
+        simd::floatv inside = pl.nx[0] * x + pl.ny[0] * y + pl.nz[0] * z + pl.d[0] >= nr;
+        for (int j = 1; j < 6; ++j) {
+            inside = inside & (pl.nx[j] * x + pl.ny[j] * y + pl.nz[j] * z + pl.d[j] >= nr);
+        }
+        n += bounds_simd::compact(simd::mask(inside), i, out + n);
+    }
+    for (; i < count; ++i) {
+        out[n] = i;
+        n += f.intersects(spheres[i]);
+    }
+    return n;
+}
+
+static int cull_boxes(const frustum& f, const aabb* boxes, int count, int* out) {
+    bounds_simd::planes pl(f);
+    const float* p = &boxes->min.x;
+    int n = 0, i = 0;
+    for (; i + simd::lanes <= count; i += simd::lanes, p += simd::lanes * 6) {
+        simd::floatv cx, cy, cz, ex, ey, ez;
+        bounds_simd::load_boxes(p, cx, cy, cz, ex, ey, ez);
+        simd::floatv inside = pl.nx[0] * cx + pl.ny[0] * cy + pl.nz[0] * cz + pl.d[0] >= -(pl.ax[0] * ex + pl.ay[0] * ey + pl.az[0] * ez);
+        for (int j = 1; j < 6; ++j) {
+            inside = inside & (pl.nx[j] * cx + pl.ny[j] * cy + pl.nz[j] * cz + pl.d[j] >= -(pl.ax[j] * ex + pl.ay[j] * ey + pl.az[j] * ez));
+        }
+        n += bounds_simd::compact(simd::mask(inside), i, out + n);
+    }
+    for (; i < count; ++i) {
+        out[n] = i;
+        n += f.intersects(boxes[i]);
+    }
+    return n;
+}
+
+// Every box the ray enters before max_distance, unordered by distance.
+static int raycast_boxes(const ray& r, const aabb* boxes, int count, int* out, float max_distance = std::numeric_limits<float>::infinity()) {
+    simd::floatv ox = simd::setv(r.origin.x), oy = simd::setv(r.origin.y), oz = simd::setv(r.origin.z);
+    simd::floatv ix = simd::setv(1.0f / r.direction.x), iy = simd::setv(1.0f / r.direction.y), iz = simd::setv(1.0f / r.direction.z);
+    simd::floatv zero = simd::setv(0.0f), limit = simd::setv(max_distance);
+    const float* p = &boxes->min.x;
+    int n = 0, i = 0;
+    for (; i + simd::lanes <= count; i += simd::lanes, p += simd::lanes * 6) {
+        simd::floatv ax, ay, az, bx, by, bz, min_x, min_y, min_z, max_x, max_y, max_z;
+        simd::load_xyz(p, ax, ay, az);
+        simd::load_xyz(p + simd::lanes * 3, bx, by, bz);
+        simd::deinterleave(ax, bx, min_x, max_x);
+        simd::deinterleave(ay, by, min_y, max_y);
+        simd::deinterleave(az, bz, min_z, max_z);
+
+        simd::floatv x0 = (min_x - ox) * ix, x1 = (max_x - ox) * ix;
+        simd::floatv y0 = (min_y - oy) * iy, y1 = (max_y - oy) * iy;
+        simd::floatv z0 = (min_z - oz) * iz, z1 = (max_z - oz) * iz;
+        simd::floatv t0 = simd::max(simd::max(simd::min(x0, x1), simd::min(y0, y1)), simd::max(simd::min(z0, z1), zero));
+        simd::floatv t1 = simd::min(simd::min(simd::max(x0, x1), simd::max(y0, y1)), simd::min(simd::max(z0, z1), limit));
+        n += bounds_simd::compact(simd::mask(t0 <= t1), i, out + n);
+    }
+    for (; i < count; ++i) {
+        float t;
+        out[n] = i;
+        n += r.intersects(boxes[i], t, max_distance);
+    }
+    return n;
+}
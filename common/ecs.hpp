@@ -0,0 +1,474 @@
+#pragma once
+#include <vector>
+#include <memory>
+#include <mutex>
+#include <atomic>
+#include <functional>
+#include <algorithm>
+#include <utility>
+#include <type_traits>
+#include <cstdint>
+#include <cstring>
+#include <cassert>
+#include "job_system.hpp"
+
+// Entities and components, for the thousands of simple objects (ships,
+// projectiles, asteroids) that would be far too heavy as a node subclass each.
+//
+// Entities with the same set of component types share an archetype. It keeps
+// them in fixed size chunks, and inside a chunk each component type is one
+// contiguous array, so a system reading two components of every asteroid walks
+// two arrays front to back. A query finds the archetypes holding its component
+// types once and caches them; later runs only check archetypes made since.
+//
+// Creating and destroying entities and adding or removing components move
+// entities between archetypes, which would pull the arrays out from under a
+// running system. Those changes are queued, from any thread, and applied in
+// order by sync(). Entity handles are valid straight away; their components are
+// there after the sync.
+//
+// Components must be trivially copyable, like the maths types, so moving one
+// between chunks is a memcpy.
+namespace ecs {
+
+struct entity {
+    uint32_t index, generation;
+
+    bool operator==(const entity& e) const { return index == e.index && generation == e.generation; }
+    bool operator!=(const entity& e) const { return !(*this == e); }
+};
+
+static const int max_components = 64;
+static const int chunk_bytes = 16 * 1024;
+
+// Ids for component types, given out as each type is first used.
+class component_types {
+    struct info {
+        size_t size, align;
+    };
+
+    static info* infos() {
+        static info table[max_components];
+        return table;
+    }
+
+    static int add(size_t size, size_t align) {
+        static std::atomic<int> count(0);
+        int id = count.fetch_add(1);
+        assert(id < max_components && "too many component types");
+        infos()[id] = info{ size, align };
+        return id;
+    }
+
+public:
+    template <class T>
+    static int id() {
+        static_assert(std::is_trivially_copyable<T>::value, "components must be trivially copyable");
+        static const int i = add(sizeof(T), alignof(T));
+        return i;
+    }
+
+    static size_t size(int id) { return infos()[id].size; }
+    static size_t align(int id) { return infos()[id].align; }
+
+    // One bit per type.
+    template <class... Ts>
+    static uint64_t mask() {
+        uint64_t m = 0;
+        int expand[] = { 0, (m |= uint64_t(1) << id<typename std::remove_const<Ts>::type>(), 0)... };
+        (void)expand;
+        return m;
+    }
+};
+
+class world;
+template <class... Ts> class query;
+
+// Every entity with one particular set of component types. Rows are dense: a
+// removed entity's place is filled by the last one.
+class archetype {
+    friend class world;
+    template <class... Ts> friend class query;
+
+    // Systems get each array from columns rather than as an offset from data.
+    // With a loop reading one array and writing another at offsets from the same
+    // base, GCC 12's induction variable rewrite (-fivopts) addresses the stores
+    // as null plus an index; the side effect analysis then takes them for a null
+    // dereference and skips them, and calls to the loop are deleted as having
+    // no effect. scene_bench checks for the lost writes.
+    struct chunk {
+        std::unique_ptr<unsigned char[]> buffer;
+        unsigned char* data; // the entities, then one array per component type
+        std::vector<unsigned char*> columns; // where each type's array starts in data
+        int count;
+    };
+
+    uint64_t mask;
+    std::vector<int> types;      // component ids, ascending
+    std::vector<size_t> sizes;   // of each type
+    std::vector<size_t> offsets; // of each type's array in a chunk
+    size_t bytes;
+    int capacity; // entities per chunk
+    int count;
+    std::vector<chunk> chunks;
+
+    explicit archetype(uint64_t mask) : mask(mask), count(0) {
+        size_t row = sizeof(entity);
+        for (int t = 0; t < max_components; ++t) {
+            if (mask >> t & 1) {
+                types.push_back(t);
+                sizes.push_back(component_types::size(t));
+                row += sizes.back();
+            }
+        }
+        capacity = std::max<int>(1, int(chunk_bytes / row));
+        while ((bytes = layout(capacity)) > size_t(chunk_bytes) && capacity > 1) {
+            --capacity;
+        }
+    }
+
+    // Place the arrays for n entities; returns the bytes they take.
+    size_t layout(int n) {
+        offsets.clear();
+        size_t end = sizeof(entity) * n;
+        for (size_t k = 0; k < types.size(); ++k) {
+            size_t align = component_types::align(types[k]);
+            offsets.push_back((end + align - 1) / align * align);
+            end = offsets.back() + sizes[k] * n;
+        }
+        return end;
+    }
+
+    int column(int type) const {
+        auto it = std::lower_bound(types.begin(), types.end(), type);
+        return it != types.end() && *it == type ? int(it - types.begin()) : -1;
+    }
+
+    unsigned char* at(int row, int column) {
+        return chunks[row / capacity].columns[column] + sizes[column] * (row % capacity);
+    }
+
+    entity& entity_at(int row) {
+        return reinterpret_cast<entity*>(chunks[row / capacity].data)[row % capacity];
+    }
+
+    // A new row for e, its components uninitialized.
+    int push(entity e) {
+        if (count == (int)chunks.size() * capacity) {
+            chunk c;
+            c.buffer.reset(new unsigned char[bytes + 63]);
+            c.data = reinterpret_cast<unsigned char*>((reinterpret_cast<uintptr_t>(c.buffer.get()) + 63) & ~uintptr_t(63));
+            for (size_t offset : offsets) {
+                c.columns.push_back(c.data + offset);
+            }
+            c.count = 0;
+            chunks.push_back(std::move(c));
+        }
+        int row = count++;
+        ++chunks.back().count;
+        entity_at(row) = e;
+        return row;
+    }
+
+    // Remove row by moving the last row into it. Returns the entity that moved,
+    // or row's own entity if it was the last.
+    entity swap_remove(int row) {
+        int last = --count;
+        if (row != last) {
+            entity_at(row) = entity_at(last);
+            for (size_t k = 0; k < types.size(); ++k) {
+                std::memcpy(at(row, (int)k), at(last, (int)k), sizes[k]);
+            }
+        }
+        entity moved = entity_at(row);
+        if (--chunks.back().count == 0) {
+            chunks.pop_back();
+        }
+        return moved;
+    }
+
+public:
+    archetype(const archetype&) = delete;
+    archetype& operator=(const archetype&) = delete;
+
+    int size() const { return count; }
+    int chunk_count() const { return (int)chunks.size(); }
+    int chunk_capacity() const { return capacity; }
+
+    bool has(int type) const {
+        return (mask >> type & 1) != 0;
+    }
+};
+
+class world {
+    template <class... Ts> friend class query;
+
+    struct record {
+        archetype* type; // null while the entity is queued or dead
+        int row;
+        uint32_t generation;
+    };
+
+    std::vector<record> records;           // by entity index; only grows in sync()
+    std::vector<uint32_t> free_indices;
+    uint32_t reserved;                     // indices handed out so far
+    std::vector<std::unique_ptr<archetype>> archetypes;
+    std::mutex command_mutex;
+    std::vector<std::function<void()>> commands;
+    std::vector<std::function<void(world&, float)>> systems;
+
+    archetype& find(uint64_t mask) {
+        for (auto& a : archetypes) {
+            if (a->mask == mask) {
+                return *a;
+            }
+        }
+        archetypes.emplace_back(new archetype(mask));
+        return *archetypes.back();
+    }
+
+    void queue(std::function<void()> fn) {
+        std::lock_guard<std::mutex> lock(command_mutex);
+        commands.push_back(std::move(fn));
+    }
+
+    void erase(archetype& a, int row) {
+        entity moved = a.swap_remove(row);
+        records[moved.index].row = row;
+    }
+
+    // Move e to archetype to, copying the components both have.
+    void move(entity e, archetype& to) {
+        record& r = records[e.index];
+        archetype& from = *r.type;
+        int row = to.push(e);
+        for (size_t k = 0; k < to.types.size(); ++k) {
+            int c = from.column(to.types[k]);
+            if (c >= 0) {
+                std::memcpy(to.at(row, (int)k), from.at(r.row, c), to.sizes[k]);
+            }
+        }
+        erase(from, r.row);
+        r.type = &to;
+        r.row = row;
+    }
+
+    template <class T>
+    void store(entity e, const T& value) {
+        const record& r = records[e.index];
+        std::memcpy(r.type->at(r.row, r.type->column(component_types::id<T>())), &value, sizeof(T));
+    }
+
+    template <class... Ts>
+    void place(entity e, const Ts&... components) {
+        if (e.index >= records.size()) {
+            records.resize(e.index + 1, record{ nullptr, 0, 0 });
+        }
+        archetype& a = find(component_types::mask<Ts...>());
+        records[e.index] = record{ &a, a.push(e), e.generation };
+        int expand[] = { 0, (store(e, components), 0)... };
+        (void)expand;
+    }
+
+public:
+    world() : reserved(0) { }
+
+    world(const world&) = delete;
+    world& operator=(const world&) = delete;
+
+    // A new entity with the given components, from the next sync().
+    template <class... Ts>
+    entity create(const Ts&... components) {
+        std::lock_guard<std::mutex> lock(command_mutex);
+        entity e;
+        if (free_indices.empty()) {
+            e = entity{ reserved++, 0 };
+        } else {
+            e = entity{ free_indices.back(), records[free_indices.back()].generation };
+            free_indices.pop_back();
+        }
+        commands.push_back([this, e, components...] { place(e, components...); });
+        return e;
+    }
+
+    // Queue e's removal. Its handle goes stale at the next sync().
+    void destroy(entity e) {
+        queue([this, e] {
+            if (alive(e)) {
+                record& r = records[e.index];
+                erase(*r.type, r.row);
+                r.type = nullptr;
+                ++r.generation;
+                free_indices.push_back(e.index);
+            }
+        });
+    }
+
+    // Queue adding a T to e, or setting it if e already has one.
+    template <class T>
+    void add(entity e, const T& value) {
+        queue([this, e, value] {
+            if (alive(e)) {
+                uint64_t mask = records[e.index].type->mask | component_types::mask<T>();
+                if (mask != records[e.index].type->mask) {
+                    move(e, find(mask));
+                }
+                store(e, value);
+            }
+        });
+    }
+
+    template <class T>
+    void remove(entity e) {
+        queue([this, e] {
+            if (alive(e) && has<T>(e)) {
+                move(e, find(records[e.index].type->mask & ~component_types::mask<T>()));
+            }
+        });
+    }
+
+    // Apply the queued changes, in the order they were made. Nothing may be
+    // iterating the world meanwhile.
+    void sync() {
+        std::vector<std::function<void()>> pending;
+        {
+            std::lock_guard<std::mutex> lock(command_mutex);
+            pending.swap(commands);
+        }
+        for (auto& fn : pending) {
+            fn();
+        }
+    }
+
+    bool alive(entity e) const {
+        return e.index < records.size() && records[e.index].generation == e.generation && records[e.index].type;
+    }
+
+    template <class T>
+    bool has(entity e) const {
+        return alive(e) && records[e.index].type->has(component_types::id<T>());
+    }
+
+    // e's T, or null if it has none. Valid until the next sync().
+    template <class T>
+    T* get(entity e) {
+        if (!has<T>(e)) {
+            return nullptr;
+        }
+        const record& r = records[e.index];
+        return reinterpret_cast<T*>(r.type->at(r.row, r.type->column(component_types::id<T>())));
+    }
+
+    // Live entities, not counting ones still queued.
+    int size() const {
+        int n = 0;
+        for (auto& a : archetypes) {
+            n += a->size();
+        }
+        return n;
+    }
+
+    const std::vector<std::unique_ptr<archetype>>& types() const {
+        return archetypes;
+    }
+
+    // Systems run in the order they were added, then the changes they queued are
+    // applied.
+    void add_system(std::function<void(world&, float)> system) {
+        systems.push_back(std::move(system));
+    }
+
+    void update(float dt) {
+        for (auto& system : systems) {
+            system(*this, dt);
+        }
+        sync();
+    }
+};
+
+// Every entity having all of Ts, visited a chunk at a time. Component types can
+// be const to read only.
+template <class... Ts>
+class query {
+    static_assert(sizeof...(Ts) > 0, "a query needs at least one component type");
+
+    struct match {
+        archetype* type;
+        int columns[sizeof...(Ts)];
+    };
+
+    world& w;
+    uint64_t mask;
+    size_t checked; // archetypes of w looked at so far
+    std::vector<match> matches;
+    std::vector<std::pair<int, int>> work; // match, chunk; for the parallel each_chunk
+
+    void refresh() {
+        for (; checked < w.archetypes.size(); ++checked) {
+            archetype* a = w.archetypes[checked].get();
+            if ((a->mask & mask) == mask) {
+                matches.push_back(match{ a, { a->column(component_types::id<typename std::remove_const<Ts>::type>())... } });
+            }
+        }
+    }
+
+    template <class Fn, size_t... I>
+    static void call(Fn& fn, const match& m, const archetype::chunk& c, std::index_sequence<I...>) {
+        fn(c.count, reinterpret_cast<const entity*>(c.data), reinterpret_cast<Ts*>(c.columns[m.columns[I]])...);
+    }
+
+public:
+    explicit query(world& w) : w(w), mask(component_types::mask<Ts...>()), checked(0) { }
+
+    // fn(int count, const entity* entities, Ts*... components) per chunk, each
+    // array holding count entities.
+    template <class Fn>
+    void each_chunk(Fn fn) {
+        refresh();
+        for (const match& m : matches) {
+            for (const archetype::chunk& c : m.type->chunks) {
+                call(fn, m, c, std::index_sequence_for<Ts...>());
+            }
+        }
+    }
+
+    // The same with the chunks spread over jobs; fn must be safe to run
+    // concurrently for different chunks.
+    template <class Fn>
+    void each_chunk(job_system& jobs, Fn fn) {
+        refresh();
+        work.clear();
+        for (size_t k = 0; k < matches.size(); ++k) {
+            for (size_t c = 0; c < matches[k].type->chunks.size(); ++c) {
+                work.push_back(std::make_pair((int)k, (int)c));
+            }
+        }
+        jobs.parallel_for(0, (int)work.size(), 1, [this, &fn](int begin, int end) {
+            for (int i = begin; i < end; ++i) {
+                const match& m = matches[work[i].first];
+                call(fn, m, m.type->chunks[work[i].second], std::index_sequence_for<Ts...>());
+            }
+        });
+    }
+
+    // fn(Ts&... components) per entity.
+    template <class Fn>
+    void each(Fn fn) {
+        each_chunk([&fn](int count, const entity*, Ts*... components) {
+            for (int i = 0; i < count; ++i) {
+                fn(components[i]...);
+            }
+        });
+    }
+
+    int size() {
+        refresh();
+        int n = 0;
+        for (const match& m : matches) {
+            n += m.type->size();
+        }
+        return n;
+    }
+};
+
+}
@@ -0,0 +1,79 @@
+#pragma once
+#include <chrono>
+#include <cmath>
+
+// Turns the real time between frames into a whole number of fixed simulation
+// ticks, so the simulation runs at the same rate however fast frames are drawn.
+// Time short of a tick carries over to the next frame; alpha() is how far into
+// the next tick it reaches, for drawing between the last two ticks.
+//
+// After a stall (a breakpoint, a level loading) at most max_steps ticks run in
+// one frame and the rest of the backlog is dropped: the simulation falls behind
+// real time for a moment, rather than every frame taking longer to catch up
+// than the one before.
+class fixed_timestep {
+    typedef std::chrono::steady_clock clock; // monotonic, which high_resolution_clock needn't be
+
+    double tick; // seconds
+    int max_steps;
+    double accumulator;
+    clock::time_point last;
+    bool started;
+    long long run, dropped;
+
+public:
+    explicit fixed_timestep(double rate = 60.0, int max_steps = 5)
+        : tick(1.0 / rate), max_steps(max_steps), accumulator(0.0), started(false), run(0), dropped(0) { }
+
+    // Ticks per second. Takes effect from the next advance().
+    void set_rate(double rate) {
+        tick = 1.0 / rate;
+    }
+
+    double rate() const {
+        return 1.0 / tick;
+    }
+
+    // The time each tick simulates.
+    float dt() const {
+        return (float)tick;
+    }
+
+    // The ticks to run for the time since the last call; none on the first.
+    int advance() {
+        clock::time_point now = clock::now();
+        double elapsed = started ? std::chrono::duration<double>(now - last).count() : 0.0;
+        last = now;
+        started = true;
+        return advance(elapsed);
+    }
+
+    // The ticks to run for elapsed seconds.
+    int advance(double elapsed) {
+        accumulator += elapsed;
+        int steps = (int)(accumulator / tick);
+        if (steps > max_steps) {
+            dropped += steps - max_steps;
+            steps = max_steps;
+            accumulator = std::fmod(accumulator, tick);
+        } else {
+            accumulator -= steps * tick;
+        }
+        run += steps;
+        return steps;
+    }
+
+    // How far the time carried over reaches into the next tick, from 0 to 1.
+    float alpha() const {
+        return (float)(accumulator / tick);
+    }
+
+    // Ticks run and dropped so far.
+    long long ticks() const {
+        return run;
+    }
+
+    long long ticks_dropped() const {
+        return dropped;
+    }
+};
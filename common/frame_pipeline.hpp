@@ -0,0 +1,61 @@
+#pragma once
+#include <cassert>
+#include "job_system.hpp"
+
+// Overlaps simulating one frame with rendering the one before, so a frame takes
+// the longer of the two rather than their sum. The simulation step runs on a job
+// and ends by extracting what the renderer needs into a snapshot of type T (a
+// render_queue, say); the thread with the GL context renders the previous
+// snapshot meanwhile. There are two snapshots, and each thread only ever
+// touches its own.
+//
+// finish() is the one point where the threads meet: with no step in flight the
+// scene is the caller's again, to read input into, until the next start().
+//
+//     pipeline.finish();
+//     ... handle input ...
+//     pipeline.start([&](T& next) { simulate(); extract(next); });
+//     render(pipeline.front());
+template <class T>
+class frame_pipeline {
+    job_system& jobs;
+    T snapshots[2];
+    int rendered; // the snapshot front() returns
+    job_counter simulating;
+    bool in_flight;
+
+public:
+    explicit frame_pipeline(job_system& jobs) : jobs(jobs), rendered(0), in_flight(false) { }
+
+    frame_pipeline(const frame_pipeline&) = delete;
+    frame_pipeline& operator=(const frame_pipeline&) = delete;
+
+    ~frame_pipeline() {
+        finish();
+    }
+
+    // Wait for the step in flight, if any, and make its snapshot the front one.
+    // Runs other jobs while it waits.
+    void finish() {
+        if (in_flight) {
+            jobs.wait(simulating);
+            in_flight = false;
+            rendered ^= 1;
+        }
+    }
+
+    // Run step(back snapshot) on a job. Until finish(), the scene belongs to the
+    // step and only front() may be touched.
+    template <class Fn>
+    void start(Fn step) {
+        assert(!in_flight && "finish() the last step first");
+        T& back = snapshots[rendered ^ 1];
+        jobs.run([step, &back]() mutable { step(back); }, &simulating);
+        in_flight = true;
+    }
+
+    // The snapshot the last finished step extracted, to render.
+    T& front() {
+        return snapshots[rendered];
+    }
+};
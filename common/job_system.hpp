@@ -0,0 +1,282 @@
+#pragma once
+#include <atomic>
+#include <condition_variable>
+#include <deque>
+#include <functional>
+#include <mutex>
+#include <thread>
+#include <vector>
+#include <algorithm>
+
+class job_system;
+
+// Counts the unfinished jobs signalling it. Jobs can be made to wait for one with
+// job_system::run_after, and any thread can wait for one with job_system::wait.
+class job_counter {
+    friend class job_system;
+
+    struct continuation {
+        std::function<void()> fn;
+        job_counter* signal;
+        bool main_thread;
+    };
+
+    std::atomic<int> pending;
+    std::mutex m;
+    std::vector<continuation> continuations;
+
+public:
+    job_counter() : pending(0) { }
+
+    job_counter(const job_counter&) = delete;
+    job_counter& operator=(const job_counter&) = delete;
+
+    bool done() const {
+        return pending.load(std::memory_order_acquire) == 0;
+    }
+};
+
+// A work-stealing job scheduler. Each worker thread owns a deque: it pushes and
+// pops its own jobs at the back, most recent first while they are still in its
+// cache, and idle workers steal the oldest jobs from the front of the others.
+// Threads that are not workers (the main thread) share one more deque.
+//
+// Jobs that must run on the main thread, like anything touching the GL context,
+// go to a separate queue that only the main thread (the one that created the
+// job_system) runs, from run_main_jobs() or while it waits.
+//
+// Waiting never blocks a thread that could be working: wait() runs other jobs
+// until the counter is done, so jobs can wait for jobs they spawn. With zero
+// workers every job simply runs on the thread that waits for it.
+class job_system {
+public:
+    enum affinity {
+        any_thread,
+        main_thread
+    };
+
+    // One worker per hardware thread besides the main thread by default.
+    explicit job_system(int workers = -1) : running(true), queued(0), main_id(std::this_thread::get_id()) {
+        if (workers < 0) {
+            workers = std::max(0, int(std::thread::hardware_concurrency()) - 1);
+        }
+        queues = std::vector<queue>(workers + 1);
+        for (int i = 0; i < workers; ++i) {
+            threads.emplace_back([this, i] { work(i); });
+        }
+    }
+
+    job_system(const job_system&) = delete;
+    job_system& operator=(const job_system&) = delete;
+
+    ~job_system() {
+        {
+            std::lock_guard<std::mutex> lock(sleep_mutex);
+            running = false;
+        }
+        wake.notify_all();
+        for (std::thread& t : threads) {
+            t.join();
+        }
+    }
+
+    // Worker threads, not counting the main thread.
+    int workers() const {
+        return (int)threads.size();
+    }
+
+    // Schedule fn. signal, if given, counts it until it has run.
+    void run(std::function<void()> fn, job_counter* signal = nullptr, affinity a = any_thread) {
+        if (signal) {
+            signal->pending.fetch_add(1, std::memory_order_relaxed);
+        }
+        push(job{ std::move(fn), signal }, a == main_thread);
+    }
+
+    // Schedule fn once dependency is done; straight away if it already is.
+    void run_after(job_counter& dependency, std::function<void()> fn, job_counter* signal = nullptr, affinity a = any_thread) {
+        if (signal) {
+            signal->pending.fetch_add(1, std::memory_order_relaxed);
+        }
+        {
+            std::lock_guard<std::mutex> lock(dependency.m);
+            if (!dependency.done()) {
+                dependency.continuations.push_back(job_counter::continuation{ std::move(fn), signal, a == main_thread });
+                return;
+            }
+        }
+        push(job{ std::move(fn), signal }, a == main_thread);
+    }
+
+    // Run jobs until counter is done.
+    void wait(job_counter& counter) {
+        while (!counter.done()) {
+            if (!run_one()) {
+                std::this_thread::yield();
+            }
+        }
+        // The last job counts off under the counter's lock; once we hold it the
+        // job is finished with the counter, and the caller may destroy it.
+        std::lock_guard<std::mutex> lock(counter.m);
+    }
+
+    // Run every queued main thread job. Only call this from the main thread.
+    void run_main_jobs() {
+        job j;
+        while (pop(main_jobs, j, false)) {
+            execute(j);
+        }
+    }
+
+    // fn(chunk_begin, chunk_end) over [begin, end) in chunks of at least grain
+    // elements, spread over the workers and the calling thread. Returns when all
+    // of them have run.
+    template <class Fn>
+    void parallel_for(int begin, int end, int grain, Fn fn) {
+        int count = end - begin;
+        if (count <= 0) {
+            return;
+        }
+        int chunks = std::max(1, std::min(count / std::max(1, grain), (workers() + 1) * 4));
+        if (chunks == 1) {
+            fn(begin, end);
+            return;
+        }
+
+        job_counter done;
+        int chunk = (count + chunks - 1) / chunks;
+        for (int b = begin + chunk; b < end; b += chunk) {
+            int e = std::min(end, b + chunk);
+            run([&fn, b, e] { fn(b, e); }, &done);
+        }
+        fn(begin, std::min(end, begin + chunk));
+        wait(done);
+    }
+
+    // The calling thread's queue: its own for a worker, the shared one otherwise.
+    int current_queue() const {
+        const worker_id& id = current();
+        return id.system == this ? id.index : workers();
+    }
+
+private:
+    struct job {
+        std::function<void()> fn;
+        job_counter* signal;
+    };
+
+    struct queue {
+        std::mutex m;
+        std::deque<job> jobs;
+    };
+
+    struct worker_id {
+        const job_system* system;
+        int index;
+    };
+
+    static worker_id& current() {
+        static thread_local worker_id id{ nullptr, -1 };
+        return id;
+    }
+
+    std::vector<queue> queues;
+    queue main_jobs;
+    std::vector<std::thread> threads;
+
+    std::mutex sleep_mutex;
+    std::condition_variable wake;
+    bool running;
+    std::atomic<int> queued; // jobs in queues, for sleeping workers to wait on
+    std::thread::id main_id;
+
+    void push(job j, bool main) {
+        queue& q = main ? main_jobs : queues[current_queue()];
+        {
+            std::lock_guard<std::mutex> lock(q.m);
+            q.jobs.push_back(std::move(j));
+        }
+        if (!main) {
+            queued.fetch_add(1, std::memory_order_release);
+            { std::lock_guard<std::mutex> lock(sleep_mutex); }
+            wake.notify_one();
+        }
+    }
+
+    // The newest job of q, or the oldest.
+    bool pop(queue& q, job& j, bool newest) {
+        std::lock_guard<std::mutex> lock(q.m);
+        if (q.jobs.empty()) {
+            return false;
+        }
+        if (newest) {
+            j = std::move(q.jobs.back());
+            q.jobs.pop_back();
+        } else {
+            j = std::move(q.jobs.front());
+            q.jobs.pop_front();
+        }
+        return true;
+    }
+
+    bool take(job& j) {
+        int self = current_queue(), n = (int)queues.size();
+        for (int k = 0; k < n; ++k) {
+            int i = (self + k) % n;
+            if (pop(queues[i], j, i == self)) { // own jobs newest first, stolen ones oldest first
+                queued.fetch_sub(1, std::memory_order_relaxed);
+                return true;
+            }
+        }
+        return false;
+    }
+
+    bool run_one() {
+        job j;
+        if (std::this_thread::get_id() == main_id && pop(main_jobs, j, false)) {
+            execute(j);
+            return true;
+        }
+        if (take(j)) {
+            execute(j);
+            return true;
+        }
+        return false;
+    }
+
+    void execute(job& j) {
+        j.fn();
+        if (j.signal) {
+            finish(*j.signal);
+        }
+    }
+
+    // Count a job off; the last one schedules whatever was waiting for the counter.
+    void finish(job_counter& c) {
+        std::vector<job_counter::continuation> ready;
+        {
+            std::lock_guard<std::mutex> lock(c.m);
+            if (c.pending.fetch_sub(1, std::memory_order_acq_rel) != 1) {
+                return;
+            }
+            ready.swap(c.continuations);
+        }
+        for (job_counter::continuation& r : ready) {
+            push(job{ std::move(r.fn), r.signal }, r.main_thread);
+        }
+    }
+
+    void work(int index) {
+        current() = worker_id{ this, index };
+        for (;;) {
+            if (run_one()) {
+                continue;
+            }
+            std::unique_lock<std::mutex> lock(sleep_mutex);
+            wake.wait(lock, [this] { return !running || queued.load(std::memory_order_acquire) > 0; });
+            if (!running) {
+                return;
+            }
+        }
+    }
+};
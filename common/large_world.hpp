@@ -0,0 +1,36 @@
+#pragma once
+#include "vector.hpp"
+
+// Large-world coordinates. The simulation keeps positions in double precision,
+// which resolves 1e-7 units at 1e9 from the origin. Rendering never sees them:
+// each frame they are rebased against the camera (render_state::origin) and
+// converted to small float offsets, so every matrix, vertex and SIMD kernel keeps
+// working in float precision near the eye. Positions are vec3d (vector.hpp).
+
+static vec3 to_vec3(const vec3d& v) {
+    return vec3{ float(v.x), float(v.y), float(v.z) };
+}
+
+static vec3d to_vec3d(const vec3& v) {
+    return vec3d{ double(v.x), double(v.y), double(v.z) };
+}
+
+// p as a float offset from origin. Precise as long as p is near origin, however
+// far the two are from zero.
+static vec3 relative_to(const vec3d& p, const vec3d& origin) {
+    return vec3{ float(p.x - origin.x), float(p.y - origin.y), float(p.z - origin.z) };
+}
+
+// out[i] = relative_to(in[i], origin) for count positions.
+static void relative_to(const vec3d& origin, const vec3d* in, vec3* out, int count) {
+    const double* p = in->data.data();
+    float* o = out->data.data();
+    double ox = origin.x, oy = origin.y, oz = origin.z;
+    for (int i = 0; i < count; ++i, p += 3, o += 3) {
+        o[0] = float(p[0] - ox);
+        o[1] = float(p[1] - oy);
+        o[2] = float(p[2] - oz);
+    }
+}
+
+static_assert(sizeof(vec3d) == 24, "vec3d must be tightly packed");
@@ -1,19 +1,20 @@
 #pragma once
 #include "vector.hpp"
 #include "matrix.hpp"
+#include "quaternion.hpp"
+#include "affine.hpp"
+#include "bounds.hpp"
+#include "fast_math.hpp"
+#include "large_world.hpp"
+#include "soa_stream.hpp"
 
 namespace {
     constexpr float pi = 3.14159265359f;
 }
 
+// Constant time, however many turns out of range the angle is. See fast_math.hpp.
 static float wrapAngle(float angle) {
-    while (angle > pi) {
-        angle -= pi * 2;
-    }
-    while (angle < -pi) {
-        angle += pi * 2;
-    }
-    return angle;
+    return fast::wrap_angle(angle);
 }
 
 static float sign(float x) {
@@ -1,20 +1,26 @@
 #pragma once
 #include <array>
+#include <utility>
+#include <type_traits>
 #include "vector.hpp"
 
+// Tag to construct a matrix without writing the identity, for results that are
+// about to be overwritten anyway.
+struct uninitialized_t { };
+constexpr uninitialized_t uninitialized{};
+
 template <class T, int Rows, int Cols>
-class matrix {
+class alignas(Rows * Cols * sizeof(T) % 16 == 0 ? 16 : alignof(T)) matrix {
 public:
     static const int Size = Rows * Cols;
     std::array<T, Size> data;
 
-    matrix() {
-        for (int y = 0; y < Rows; ++y) {
-            for (int x = 0; x < Cols; ++x) {
-                at(y, x) = (x == y ? T(1) : T(0));
-            }
-        }
-    }
+    explicit matrix(uninitialized_t) { }
+
+    constexpr matrix() : data(identity(std::make_index_sequence<Size>())) { }
+
+    // Every element in row-major order.
+    constexpr explicit matrix(const std::array<T, Size>& data) : data(data) { }
 
     template <int X, int Y>
     matrix(const matrix<T, X, Y>& other) {
@@ -31,17 +37,9 @@ public:
         }
     }
 
-    void operator=(const matrix& other) {
-        for (int y = 0; y < Rows; ++y) {
-            for (int x = 0; x < Cols; ++x) {
-                at(y, x) = other(y, x);
-            }
-        }
-    }
-
     void operator*=(const matrix& other) {
         static_assert(Rows == Cols, "Can only multiply-assign two matrices of the same dimensions.");
-        matrix result;
+        matrix result(uninitialized);
         for (int row = 0; row < Rows; ++row) {
             for (int col = 0; col < Cols; ++col) {
                 result(row, col) = T(0);
@@ -58,7 +56,7 @@ public:
         return data[col + row * Cols];
     }
 
-    const T& at(int row, int col) const {
+    constexpr const T& at(int row, int col) const {
         return data[col + row * Cols];
     }
 
@@ -66,16 +64,22 @@ public:
         return at(row, col);
     }
 
-    const T& operator()(int row, int col) const {
+    constexpr const T& operator()(int row, int col) const {
         return at(row, col);
     }
 
+private:
+    template <std::size_t... I>
+    static constexpr std::array<T, Size> identity(std::index_sequence<I...>) {
+        return {{ (I / Cols == I % Cols ? T(1) : T(0))... }};
+    }
+
 };
 
 
 template <class T, int Rows, int Inner, int Cols>
 matrix<T, Rows, Cols> operator*(const matrix<T, Rows, Inner>& left, const matrix<T, Inner, Cols>& other) {
-    matrix<T, Rows, Cols> result;
+    matrix<T, Rows, Cols> result(uninitialized);
     for (int row = 0; row < Rows; ++row) {
         for (int col = 0; col < Cols; ++col) {
             result(row, col) = T(0);
@@ -99,31 +103,147 @@ vector<T, Rows> operator*(const matrix<T, Rows, Cols>& left, const vector<T, Col
     return result;
 }
 
+#include "matrix_simd.hpp"
+
 typedef matrix<float, 4, 4> mat4;
 typedef matrix<float, 3, 3> mat3;
 
 
-static mat4 orthographic(float left, float top, float right, float bottom, float n = 0.0f, float f = 1.0f) {
-    mat4 ortho;
-    ortho(0, 0) = 2.0f / (right - left);
-    ortho(0, 3) = -(right + left) / (right - left);
-    ortho(1, 1) = 2.0f / (top - bottom);
-    ortho(1, 3) = -(top + bottom) / (top - bottom);
-    ortho(2, 2) = -2.0f / (f - n);
-    ortho(2, 3) = -(f + n) / (f - n);
-    return ortho;
+// out[i] = m * in[i] for count vectors. in and out may be the same array.
+static void transform(const mat4& m, const vec4* in, vec4* out, int count) {
+    int i = 0;
+#if defined(SIMD_AVX)
+    // Two vectors per 256 bit register, each half multiplied by a copy of the columns.
+    matrix_simd::columns c(m.data.data());
+    __m256 c0 = _mm256_set_m128(c.c0.v, c.c0.v), c1 = _mm256_set_m128(c.c1.v, c.c1.v);
+    __m256 c2 = _mm256_set_m128(c.c2.v, c.c2.v), c3 = _mm256_set_m128(c.c3.v, c.c3.v);
+    for (; i + 2 <= count; i += 2) {
+        __m256 v = _mm256_loadu_ps(in[i].data.data());
+        __m256 r = _mm256_mul_ps(c0, _mm256_permute_ps(v, 0x00));
+        r = _mm256_add_ps(r, _mm256_mul_ps(c1, _mm256_permute_ps(v, 0x55)));
+        r = _mm256_add_ps(r, _mm256_mul_ps(c2, _mm256_permute_ps(v, 0xaa)));
+        r = _mm256_add_ps(r, _mm256_mul_ps(c3, _mm256_permute_ps(v, 0xff)));
+        _mm256_storeu_ps(out[i].data.data(), r);
+    }
+#endif
+    matrix_simd::columns columns(m.data.data());
+    for (; i < count; ++i) {
+        simd::store(out[i].data.data(), columns(simd::load(in[i].data.data())));
+    }
+}
+
+// out[i] = m * in[i] for count matrices, e.g. view_projection * world[i]. in and out may be the same array.
+static void multiply(const mat4& m, const mat4* in, mat4* out, int count) {
+    for (int i = 0; i < count; ++i) {
+        matrix_simd::multiply(m.data.data(), in[i].data.data(), out[i].data.data());
+    }
+}
+
+
+// Separate x, y, z (and w) arrays holding structure-of-arrays data.
+template <class T>
+struct stream3 {
+    T *x, *y, *z;
+};
+
+template <class T>
+struct stream4 {
+    T *x, *y, *z, *w;
+};
+
+
+// Batch transforms over contiguous arrays, simd::lanes elements per iteration.
+// Points are translated (w = 1), directions are not (w = 0); both assume m is affine.
+// project_points gives clip space positions, before the perspective divide.
+// All of them work in place, and large arrays can be split across threads by
+// calling them on disjoint sub-ranges (see job_system::parallel_for).
+static void transform_points(const mat4& m, const vec3* in, vec3* out, int count) {
+    matrix_simd::transform3<true>(m.data.data(), reinterpret_cast<const float*>(in), reinterpret_cast<float*>(out), count);
+}
+
+static void transform_directions(const mat4& m, const vec3* in, vec3* out, int count) {
+    matrix_simd::transform3<false>(m.data.data(), reinterpret_cast<const float*>(in), reinterpret_cast<float*>(out), count);
+}
+
+static void transform_points(const mat4& m, stream3<const float> in, stream3<float> out, int count) {
+    matrix_simd::transform3<true>(m.data.data(), in.x, in.y, in.z, out.x, out.y, out.z, count);
+}
+
+static void transform_directions(const mat4& m, stream3<const float> in, stream3<float> out, int count) {
+    matrix_simd::transform3<false>(m.data.data(), in.x, in.y, in.z, out.x, out.y, out.z, count);
+}
+
+static void project_points(const mat4& m, const vec3* in, vec4* out, int count) {
+    using matrix_simd::row;
+    const float* e = m.data.data();
+    const float* p = reinterpret_cast<const float*>(in);
+    matrix_simd::broadcast b(e);
+    int i = 0;
+    for (; i + simd::lanes <= count; i += simd::lanes, p += simd::lanes * 3) {
+        simd::floatv x, y, z;
+        simd::load_xyz(p, x, y, z);
+        simd::store_xyzw(out[i].data.data(), b.row<0, true>(x, y, z), b.row<1, true>(x, y, z), b.row<2, true>(x, y, z), b.row<3, true>(x, y, z));
+    }
+    for (; i < count; ++i, p += 3) {
+        float x = p[0], y = p[1], z = p[2];
+        out[i] = vec4{ row<0, true>(e, x, y, z), row<1, true>(e, x, y, z), row<2, true>(e, x, y, z), row<3, true>(e, x, y, z) };
+    }
+}
+
+static void project_points(const mat4& m, stream3<const float> in, stream4<float> out, int count) {
+    using matrix_simd::row;
+    const float* e = m.data.data();
+    matrix_simd::broadcast b(e);
+    int i = 0;
+    for (; i + simd::lanes <= count; i += simd::lanes) {
+        simd::floatv x = simd::loadv(in.x + i), y = simd::loadv(in.y + i), z = simd::loadv(in.z + i);
+        simd::storev(out.x + i, b.row<0, true>(x, y, z));
+        simd::storev(out.y + i, b.row<1, true>(x, y, z));
+        simd::storev(out.z + i, b.row<2, true>(x, y, z));
+        simd::storev(out.w + i, b.row<3, true>(x, y, z));
+    }
+    for (; i < count; ++i) {
+        float x = in.x[i], y = in.y[i], z = in.z[i];
+        out.x[i] = row<0, true>(e, x, y, z);
+        out.y[i] = row<1, true>(e, x, y, z);
+        out.z[i] = row<2, true>(e, x, y, z);
+        out.w[i] = row<3, true>(e, x, y, z);
+    }
+}
+
+
+static constexpr mat4 orthographic(float left, float top, float right, float bottom, float n = 0.0f, float f = 1.0f) {
+    return mat4(std::array<float, 16>{{
+        2.0f / (right - left), 0, 0, -(right + left) / (right - left),
+        0, 2.0f / (top - bottom), 0, -(top + bottom) / (top - bottom),
+        0, 0, -2.0f / (f - n), -(f + n) / (f - n),
+        0, 0, 0, 1
+    }});
+}
+
+// Perspective projection from the tangent of half the vertical field of view.
+static constexpr mat4 perspective_tan(float t, float aspect, float n, float f) {
+    return mat4(std::array<float, 16>{{
+        1 / (aspect * t), 0, 0, 0,
+        0, 1 / t, 0, 0,
+        0, 0, f / (f - n), -(f * n) / (f - n),
+        0, 0, 1, 0
+    }});
 }
 
 static mat4 perspective(float fov, float aspect, float n, float f) {
-    float t = std::tan(fov / 2);
-    mat4 m;
-    m.at(0, 0) = 1 / (aspect * t);
-    m.at(1, 1) = 1 / t;
-    m.at(2, 2) = (f) / (f - n);
-    m.at(2, 3) = -(f * n) / (f - n);
-    m.at(3, 2) = 1;
-    m.at(3, 3) = 0;
-    return m;
+    return perspective_tan(std::tan(fov / 2), aspect, n, f);
+}
+
+// perspective_tan with the far plane at infinity, for scenes that span more depth
+// than any far plane can sensibly cover.
+static constexpr mat4 perspective_infinite_tan(float t, float aspect, float n) {
+    return mat4(std::array<float, 16>{{
+        1 / (aspect * t), 0, 0, 0,
+        0, 1 / t, 0, 0,
+        0, 0, 1, -n,
+        0, 0, 1, 0
+    }});
 }
 
 
@@ -152,41 +272,43 @@ static mat4 look_at(vec3 position, vec3 target, vec3 up) {
 }
 
 template <class T>
-matrix<T, 4, 4> translate(T x, T y, T z) {
-    matrix<T, 4, 4> ret;
-    ret(0, 3) = x;
-    ret(1, 3) = y;
-    ret(2, 3) = z;
-    return ret;
+constexpr matrix<T, 4, 4> translate(T x, T y, T z) {
+    return matrix<T, 4, 4>(std::array<T, 16>{{
+        1, 0, 0, x,
+        0, 1, 0, y,
+        0, 0, 1, z,
+        0, 0, 0, 1
+    }});
 }
 
 template <class T>
-matrix<T, 4, 4> translate(const vector<T, 3>& vec) {
-    return translate(vec.x, vec.y, vec.z);
+constexpr matrix<T, 4, 4> translate(const vector<T, 3>& vec) {
+    return translate(vec.data[0], vec.data[1], vec.data[2]);
 }
 
 template <class T>
-matrix<T, 4, 4> translate(const vector<T, 2>& vec) {
-    return translate(vec.x, vec.y, T(0));
+constexpr matrix<T, 4, 4> translate(const vector<T, 2>& vec) {
+    return translate(vec.data[0], vec.data[1], T(0));
 }
 
 template <class T>
-matrix<T, 4, 4> scale(T x, T y, T z) {
-    matrix<T, 4, 4> ret;
-    ret(0, 0) = x;
-    ret(1, 1) = y;
-    ret(2, 2) = z;
-    return ret;
+constexpr matrix<T, 4, 4> scale(T x, T y, T z) {
+    return matrix<T, 4, 4>(std::array<T, 16>{{
+        x, 0, 0, 0,
+        0, y, 0, 0,
+        0, 0, z, 0,
+        0, 0, 0, 1
+    }});
 }
 
 template <class T>
-matrix<T, 4, 4> scale(const vector<T, 3>& vec) {
-    return scale(vec.x, vec.y, vec.z);
+constexpr matrix<T, 4, 4> scale(const vector<T, 3>& vec) {
+    return scale(vec.data[0], vec.data[1], vec.data[2]);
 }
 
 template <class T>
-matrix<T, 4, 4> scale(const vector<T, 2>& vec) {
-    return scale(vec.x, vec.y, T(1));
+constexpr matrix<T, 4, 4> scale(const vector<T, 2>& vec) {
+    return scale(vec.data[0], vec.data[1], T(1));
 }
 
 static mat4 rotate(float angle, const vec3& axis) {
@@ -200,7 +322,7 @@ static mat4 rotate(float angle, const vec3& axis) {
 
     mat.at(1, 0) = axis.x * axis.y * (1 - c) + axis.z * s;
     mat.at(1, 1) = c + axis.y * axis.y * (1 - c);
-    mat.at(1, 2) = axis.y * axis.z * (1 - c) + axis.x * s;
+    mat.at(1, 2) = axis.y * axis.z * (1 - c) - axis.x * s;
 
     mat.at(2, 0) = axis.x * axis.z * (1 - c) - axis.y * s;
     mat.at(2, 1) = axis.y * axis.z * (1 - c) + axis.x * s;
@@ -208,3 +330,104 @@ static mat4 rotate(float angle, const vec3& axis) {
 
     return mat;
 }
+
+
+template <class T, int Rows, int Cols>
+matrix<T, Cols, Rows> transpose(const matrix<T, Rows, Cols>& m) {
+    matrix<T, Cols, Rows> result(uninitialized);
+    for (int row = 0; row < Rows; ++row) {
+        for (int col = 0; col < Cols; ++col) {
+            result(col, row) = m(row, col);
+        }
+    }
+    return result;
+}
+
+template <class T>
+T determinant(const matrix<T, 3, 3>& m) {
+    return m(0, 0) * (m(1, 1) * m(2, 2) - m(1, 2) * m(2, 1))
+         - m(0, 1) * (m(1, 0) * m(2, 2) - m(1, 2) * m(2, 0))
+         + m(0, 2) * (m(1, 0) * m(2, 1) - m(1, 1) * m(2, 0));
+}
+
+// The rows of the inverse transpose are the cross products of pairs of rows over
+// the determinant, so it is cheaper than the inverse itself. This is the matrix
+// that carries normals through m.
+template <class T>
+matrix<T, 3, 3> inverse_transpose(const matrix<T, 3, 3>& m) {
+    T c00 = m(1, 1) * m(2, 2) - m(1, 2) * m(2, 1), c01 = m(1, 2) * m(2, 0) - m(1, 0) * m(2, 2), c02 = m(1, 0) * m(2, 1) - m(1, 1) * m(2, 0);
+    T c10 = m(2, 1) * m(0, 2) - m(2, 2) * m(0, 1), c11 = m(2, 2) * m(0, 0) - m(2, 0) * m(0, 2), c12 = m(2, 0) * m(0, 1) - m(2, 1) * m(0, 0);
+    T c20 = m(0, 1) * m(1, 2) - m(0, 2) * m(1, 1), c21 = m(0, 2) * m(1, 0) - m(0, 0) * m(1, 2), c22 = m(0, 0) * m(1, 1) - m(0, 1) * m(1, 0);
+    T d = T(1) / (m(0, 0) * c00 + m(0, 1) * c01 + m(0, 2) * c02);
+    return matrix<T, 3, 3>(std::array<T, 9>{{
+        c00 * d, c01 * d, c02 * d,
+        c10 * d, c11 * d, c12 * d,
+        c20 * d, c21 * d, c22 * d
+    }});
+}
+
+// General inverses. A singular matrix gives infinities/NaNs, check the determinant
+// first if that is possible.
+template <class T>
+matrix<T, 3, 3> inverse(const matrix<T, 3, 3>& m) {
+    return transpose(inverse_transpose(m));
+}
+
+template <class T>
+T determinant(const matrix<T, 4, 4>& m) {
+    T s0 = m(0, 0) * m(1, 1) - m(0, 1) * m(1, 0), c5 = m(2, 2) * m(3, 3) - m(2, 3) * m(3, 2);
+    T s1 = m(0, 0) * m(1, 2) - m(0, 2) * m(1, 0), c4 = m(2, 1) * m(3, 3) - m(2, 3) * m(3, 1);
+    T s2 = m(0, 0) * m(1, 3) - m(0, 3) * m(1, 0), c3 = m(2, 1) * m(3, 2) - m(2, 2) * m(3, 1);
+    T s3 = m(0, 1) * m(1, 2) - m(0, 2) * m(1, 1), c2 = m(2, 0) * m(3, 3) - m(2, 3) * m(3, 0);
+    T s4 = m(0, 1) * m(1, 3) - m(0, 3) * m(1, 1), c1 = m(2, 0) * m(3, 2) - m(2, 2) * m(3, 0);
+    T s5 = m(0, 2) * m(1, 3) - m(0, 3) * m(1, 2), c0 = m(2, 0) * m(3, 1) - m(2, 1) * m(3, 0);
+    return s0 * c5 - s1 * c4 + s2 * c3 + s3 * c2 - s4 * c1 + s5 * c0;
+}
+
+// Cofactor expansion over the 2x2 sub-determinants of the top and bottom row pairs.
+template <class T>
+matrix<T, 4, 4> inverse(const matrix<T, 4, 4>& m) {
+    T s0 = m(0, 0) * m(1, 1) - m(0, 1) * m(1, 0), c5 = m(2, 2) * m(3, 3) - m(2, 3) * m(3, 2);
+    T s1 = m(0, 0) * m(1, 2) - m(0, 2) * m(1, 0), c4 = m(2, 1) * m(3, 3) - m(2, 3) * m(3, 1);
+    T s2 = m(0, 0) * m(1, 3) - m(0, 3) * m(1, 0), c3 = m(2, 1) * m(3, 2) - m(2, 2) * m(3, 1);
+    T s3 = m(0, 1) * m(1, 2) - m(0, 2) * m(1, 1), c2 = m(2, 0) * m(3, 3) - m(2, 3) * m(3, 0);
+    T s4 = m(0, 1) * m(1, 3) - m(0, 3) * m(1, 1), c1 = m(2, 0) * m(3, 2) - m(2, 2) * m(3, 0);
+    T s5 = m(0, 2) * m(1, 3) - m(0, 3) * m(1, 2), c0 = m(2, 0) * m(3, 1) - m(2, 1) * m(3, 0);
+    T d = T(1) / (s0 * c5 - s1 * c4 + s2 * c3 + s3 * c2 - s4 * c1 + s5 * c0);
+
+    return matrix<T, 4, 4>(std::array<T, 16>{{
+        ( m(1, 1) * c5 - m(1, 2) * c4 + m(1, 3) * c3) * d,
+        (-m(0, 1) * c5 + m(0, 2) * c4 - m(0, 3) * c3) * d,
+        ( m(3, 1) * s5 - m(3, 2) * s4 + m(3, 3) * s3) * d,
+        (-m(2, 1) * s5 + m(2, 2) * s4 - m(2, 3) * s3) * d,
+
+        (-m(1, 0) * c5 + m(1, 2) * c2 - m(1, 3) * c1) * d,
+        ( m(0, 0) * c5 - m(0, 2) * c2 + m(0, 3) * c1) * d,
+        (-m(3, 0) * s5 + m(3, 2) * s2 - m(3, 3) * s1) * d,
+        ( m(2, 0) * s5 - m(2, 2) * s2 + m(2, 3) * s1) * d,
+
+        ( m(1, 0) * c4 - m(1, 1) * c2 + m(1, 3) * c0) * d,
+        (-m(0, 0) * c4 + m(0, 1) * c2 - m(0, 3) * c0) * d,
+        ( m(3, 0) * s4 - m(3, 1) * s2 + m(3, 3) * s0) * d,
+        (-m(2, 0) * s4 + m(2, 1) * s2 - m(2, 3) * s0) * d,
+
+        (-m(1, 0) * c3 + m(1, 1) * c1 - m(1, 2) * c0) * d,
+        ( m(0, 0) * c3 - m(0, 1) * c1 + m(0, 2) * c0) * d,
+        (-m(3, 0) * s3 + m(3, 1) * s1 - m(3, 2) * s0) * d,
+        ( m(2, 0) * s3 - m(2, 1) * s1 + m(2, 2) * s0) * d
+    }});
+}
+
+template <class T>
+matrix<T, 4, 4> inverse_transpose(const matrix<T, 4, 4>& m) {
+    return transpose(inverse(m));
+}
+
+
+// Matrices are plain values: copies are memcpy/memmove and constant transforms fold at compile time.
+static_assert(std::is_trivially_copyable<mat4>::value && std::is_trivially_copyable<mat3>::value, "matrices must be trivially copyable");
+static_assert(std::is_standard_layout<mat4>::value && std::is_standard_layout<mat3>::value, "matrices must be standard layout");
+static_assert(std::get<5>(mat4().data) == 1.0f && std::get<7>(translate(1.0f, 2.0f, 3.0f).data) == 2.0f && std::get<10>(scale(vec3{ 1.0f, 2.0f, 3.0f }).data) == 3.0f,
+              "constant transforms must be constexpr");
+static_assert(std::get<0>(orthographic(-1.0f, 1.0f, 1.0f, -1.0f).data) == 1.0f && std::get<14>(perspective_tan(1.0f, 1.0f, 1.0f, 2.0f).data) == 1.0f,
+              "projections must be constexpr");
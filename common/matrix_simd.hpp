@@ -0,0 +1,122 @@
+#pragma once
+#include "simd.hpp"
+
+// Packed 4x4 float kernels. Only included from matrix.hpp, after the generic
+// operators. The kernels work on raw row-major float[16] so they can be shared
+// by the operator specializations and the batch functions.
+
+namespace matrix_simd {
+
+    // out = a * b. out may alias either input.
+    inline void multiply(const float* a, const float* b, float* out) {
+        simd::float4 b0 = simd::load(b), b1 = simd::load(b + 4), b2 = simd::load(b + 8), b3 = simd::load(b + 12);
+        for (int row = 0; row < 4; ++row) {
+            simd::float4 r = simd::load(a + row * 4);
+            simd::store(out + row * 4, simd::splat<0>(r) * b0 + simd::splat<1>(r) * b1 + simd::splat<2>(r) * b2 + simd::splat<3>(r) * b3);
+        }
+    }
+
+    // The columns of m, so that m * v == c0 * v.x + c1 * v.y + c2 * v.z + c3 * v.w.
+    struct columns {
+        simd::float4 c0, c1, c2, c3;
+
+        explicit columns(const float* m) :
+            c0(simd::load(m)), c1(simd::load(m + 4)), c2(simd::load(m + 8)), c3(simd::load(m + 12)) {
+            simd::transpose(c0, c1, c2, c3);
+        }
+
+        simd::float4 operator()(simd::float4 v) const {
+            return c0 * simd::splat<0>(v) + c1 * simd::splat<1>(v) + c2 * simd::splat<2>(v) + c3 * simd::splat<3>(v);
+        }
+    };
+
+    inline simd::float4 multiply(const float* m, simd::float4 v) {
+        simd::float4 r0 = simd::load(m) * v, r1 = simd::load(m + 4) * v, r2 = simd::load(m + 8) * v, r3 = simd::load(m + 12) * v;
+        simd::transpose(r0, r1, r2, r3);
+        return r0 + r1 + r2 + r3;
+    }
+
+    // Every element of m broadcast across the widest register, for transforming
+    // simd::lanes points at a time held as separate x, y and z registers.
+    struct broadcast {
+        simd::floatv e[16];
+
+        explicit broadcast(const float* m) {
+            for (int i = 0; i < 16; ++i) {
+                e[i] = simd::setv(m[i]);
+            }
+        }
+
+        // Row R of m applied to (x, y, z, 1) when W is set, (x, y, z, 0) otherwise.
+        template <int R, bool W>
+        simd::floatv row(simd::floatv x, simd::floatv y, simd::floatv z) const {
+            simd::floatv r = e[R * 4] * x + e[R * 4 + 1] * y + e[R * 4 + 2] * z;
+            return W ? r + e[R * 4 + 3] : r;
+        }
+    };
+
+    template <int R, bool W>
+    inline float row(const float* m, float x, float y, float z) {
+        return m[R * 4] * x + m[R * 4 + 1] * y + m[R * 4 + 2] * z + (W ? m[R * 4 + 3] : 0.0f);
+    }
+
+    // Transform count packed vec3s. W selects points (translated) or directions.
+    template <bool W>
+    inline void transform3(const float* m, const float* in, float* out, int count) {
+        broadcast b(m);
+        int i = 0;
+        for (; i + simd::lanes <= count; i += simd::lanes, in += simd::lanes * 3, out += simd::lanes * 3) {
+            simd::floatv x, y, z;
+            simd::load_xyz(in, x, y, z);
+            simd::store_xyz(out, b.row<0, W>(x, y, z), b.row<1, W>(x, y, z), b.row<2, W>(x, y, z));
+        }
+        for (; i < count; ++i, in += 3, out += 3) {
+            float x = in[0], y = in[1], z = in[2];
+            out[0] = row<0, W>(m, x, y, z);
+            out[1] = row<1, W>(m, x, y, z);
+            out[2] = row<2, W>(m, x, y, z);
+        }
+    }
+
+    // The same over separate x, y and z arrays.
+    template <bool W>
+    inline void transform3(const float* m, const float* x, const float* y, const float* z, float* ox, float* oy, float* oz, int count) {
+        broadcast b(m);
+        int i = 0;
+        for (; i + simd::lanes <= count; i += simd::lanes) {
+            simd::floatv vx = simd::loadv(x + i), vy = simd::loadv(y + i), vz = simd::loadv(z + i);
+            simd::storev(ox + i, b.row<0, W>(vx, vy, vz));
+            simd::storev(oy + i, b.row<1, W>(vx, vy, vz));
+            simd::storev(oz + i, b.row<2, W>(vx, vy, vz));
+        }
+        for (; i < count; ++i) {
+            float vx = x[i], vy = y[i], vz = z[i];
+            ox[i] = row<0, W>(m, vx, vy, vz);
+            oy[i] = row<1, W>(m, vx, vy, vz);
+            oz[i] = row<2, W>(m, vx, vy, vz);
+        }
+    }
+}
+
+#if defined(SIMD_SSE2)
+
+template <>
+inline void matrix<float, 4, 4>::operator*=(const matrix& other) {
+    matrix_simd::multiply(data.data(), other.data.data(), data.data());
+}
+
+template <>
+inline matrix<float, 4, 4> operator*(const matrix<float, 4, 4>& left, const matrix<float, 4, 4>& other) {
+    matrix<float, 4, 4> result(uninitialized);
+    matrix_simd::multiply(left.data.data(), other.data.data(), result.data.data());
+    return result;
+}
+
+template <>
+inline vector<float, 4> operator*(const matrix<float, 4, 4>& left, const vector<float, 4>& right) {
+    vector<float, 4> result;
+    simd::store(result.data.data(), matrix_simd::multiply(left.data.data(), simd::load(right.data.data())));
+    return result;
+}
+
+#endif
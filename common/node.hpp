@@ -4,49 +4,637 @@
 #include <algorithm>
 #include <functional>
 #include "maths.hpp"
+#include "transform_hierarchy.hpp"
+#include "job_system.hpp"
+#include "node_index.hpp"
+#include "spatial_index.hpp"
+#include "sleep_schedule.hpp"
 
+class render_queue;
+class node;
+
+// Everything the nodes of one scene graph share: their transforms, the indexes
+// that find them by name and by bounds, and which of them are asleep. Nodes are
+// built with the scene they belong to, which must outlive them, and only nodes
+// of the same scene can be parent and child. Scenes are independent of each
+// other, so several can exist at once.
+class scene {
+    friend class node;
+
+    // A node whose subtree_box is out of date, with the box as it was and, once
+    // update_space() works it out, its depth below the topmost listed node.
+    struct refit_entry {
+        node* n;
+        aabb before;
+        int depth;
+    };
+
+    transform_hierarchy hierarchy;
+    node_index index;
+    spatial_index<node*> tree;
+    std::vector<node*> bounded; // by transform id, null for nodes without bounds
+    std::vector<refit_entry> refits; // a listed node's parent is always listed too
+    std::vector<int> refit_path;
+    sleep_schedule sleep;
+    job_system* jobs; // during node::update_parallel, null otherwise
+
+    void refit_subtrees();
+
+public:
+    // Nodes in existence, those update still reaches (neither asleep nor under a
+    // sleeping node), those asleep, and the wakes so far by reason.
+    struct sleep_stats {
+        int total, active, asleep;
+        int woken[sleep_schedule::reasons];
+    };
+
+    scene() : jobs(nullptr) { }
+
+    scene(const scene&) = delete;
+    scene& operator=(const scene&) = delete;
+
+    // The hierarchy holding every node's transform.
+    transform_hierarchy& transforms() {
+        return hierarchy;
+    }
+
+    // Every node by name, tag and type.
+    node_index& lookup() {
+        return index;
+    }
+
+    // Every node with bounds, by its world bounds.
+    spatial_index<node*>& space() {
+        return tree;
+    }
+
+    // Which nodes are asleep, and their timers.
+    sleep_schedule& sleepers() {
+        return sleep;
+    }
+
+    // Move the world bounds of every node whose world transform the last
+    // transforms().update() recomputed, then refit the subtree bounds above the
+    // ones that moved or were added, removed or rebounded since. Costs as much
+    // as the transforms that changed, not the nodes with bounds.
+    void update_space();
+
+    // Move the sleep timers on by dt, and put to sleep and wake the nodes asked
+    // to since the last call. Runs once per frame before the update.
+    void update_sleep(float dt);
+
+    // Wake every sleeping node whose world bounds reach within radius of center.
+    void wake_near(const vec3& center, float radius);
+
+    // Counts the nodes under each sleeping one, so costs as much as those.
+    sleep_stats count_sleep();
+};
+
+// Nodes are thin handles on their scene's transform_hierarchy, which keeps every
+// node's local and world transform in flat arrays; the child pointers here are
+// only for the virtual update and draw calls.
+//
+// Each node knows its place among its parent's children, so removing a child is
+// a swap with the last one: O(1), but the order of the remaining siblings changes.
+// The awake children come first, so update walks only those and sleeping
+// subtrees cost it nothing.
 class node {
+    friend class scene;
+
+    scene& graph;
     std::vector<node*> children;
+    int awake; // children[0, awake) are awake
+    int descendants; // nodes under this one, at any depth
     node* parent;
+    int index; // in parent->children
+    int transform;
+    node_index::entry indexed;
+    aabb local_bounds;
+    int proxy; // in space(), -1 without bounds
+    aabb subtree_box; // world bounds of this node and everything under it, as of the last update_space()
+    int refit_slot;   // in graph.refits, -1 when subtree_box is up to date
+    bool refit_all;   // subtree_box is to be recomputed from every child, not grown
+    sleep_schedule::entry sleeping;
+
+    void swap_children(int a, int b) {
+        std::swap(children[a], children[b]);
+        children[a]->index = a;
+        children[b]->index = b;
+    }
+
+    void attach(node* child) {
+        assert(child->parent == nullptr && "child already has a parent");
+        assert(&child->graph == &graph && "child belongs to another scene");
+        child->parent = this;
+        child->index = (int)children.size();
+        children.push_back(child);
+        if (!child->sleeping.asleep) {
+            swap_children(child->index, awake++);
+        }
+        for (node* n = this; n; n = n->parent) {
+            n->descendants += 1 + child->descendants;
+        }
+        refit();
+        graph.transforms().set_parent(child->transform, transform);
+        graph.lookup().file(child->indexed, typeid(*child));
+    }
+
+    // List this node and those above it in the scene's refits, for
+    // update_space() to bring their subtree_box up to date.
+    void list_refit() {
+        std::vector<scene::refit_entry>& r = graph.refits;
+        for (node* n = this; n && n->refit_slot < 0; n = n->parent) {
+            n->refit_slot = (int)r.size();
+            r.push_back(scene::refit_entry{ n, n->subtree_box, -1 });
+        }
+    }
+
+    // Mark this node's subtree_box to be recomputed from its own bounds and all
+    // its children, as one of those was added, removed or replaced.
+    void refit() {
+        refit_all = true;
+        list_refit();
+    }
+
+    // Whether a box inside outer that went from before to after has left a face
+    // of outer it was holding out, so outer may now be too big.
+    static bool leaves_face(const aabb& before, const aabb& after, const aabb& outer) {
+        if (after.is_empty()) {
+            return true;
+        }
+        for (int k = 0; k < 3; ++k) {
+            if ((before.min.data[k] == outer.min.data[k] && after.min.data[k] > outer.min.data[k]) ||
+                (before.max.data[k] == outer.max.data[k] && after.max.data[k] < outer.max.data[k])) {
+                return true;
+            }
+        }
+        return false;
+    }
+
+    // Refit after one box inside subtree_box (this node's own bounds, or a
+    // child's subtree) went from before to after. Growing is a merge; only a
+    // box pulling back from a face it was holding out makes this node
+    // recompute from all its children.
+    void refit_moved(const aabb& before, const aabb& after) {
+        if (!refit_all) {
+            if (!before.is_empty() && leaves_face(before, after, subtree_box)) {
+                refit_all = true;
+            } else if (!after.is_empty()) {
+                subtree_box.merge(after);
+            }
+        }
+        list_refit();
+    }
+
+    // Move this node across its parent's awake and sleeping children.
+    static void set_asleep(node* n, bool asleep) {
+        node* p = n->parent;
+        if (!p) {
+            return;
+        }
+        if (asleep) {
+            p->swap_children(n->index, --p->awake);
+        } else {
+            p->swap_children(n->index, p->awake++);
+        }
+    }
 
 public:
 
+    // Frustum culling counts for one frame. Each child is tested by the bounds
+    // of its whole subtree, and skipped with it if they are outside; children
+    // with nothing bounded under them are always visited.
+    struct cull_stats {
+        int tested, culled, drawn;
+    };
+
+    // The view frustum in the frame of world(), as a camera sets it up for its
+    // children, and the counts so far.
+    struct cull_state {
+        frustum view;
+        cull_stats stats;
+    };
+
+    // Rendering is camera relative: the float matrices here place the eye at the
+    // origin, and origin is where that is in large-world coordinates. Objects with
+    // precise positions go through relative() to get their float offset.
+    //
+    // cull, when set, limits drawing children to those that may be visible.
+    // queue, when set, takes draws to be sorted and issued after the traversal.
+    // rewind, from 0 to 1, draws nodes that far back from their world transforms
+    // towards the ones before the last transforms().update(), to render between
+    // fixed simulation ticks.
     struct render_state {
         mat4 projection, view, world;
+        vec3d origin;
+        cull_state* cull;
+        render_queue* queue;
+        float rewind;
+
+        vec3 relative(const vec3d& p) const {
+            return relative_to(p, origin);
+        }
     };
 
-    node() : parent(nullptr) { }
+    explicit node(scene& graph) : graph(graph), awake(0), descendants(0), parent(nullptr), index(-1), transform(graph.transforms().add()), indexed(this),
+                                  local_bounds(aabb::empty()), proxy(-1), subtree_box(aabb::empty()), refit_slot(-1), refit_all(false), sleeping(this) {
+        graph.sleepers().add(sleeping);
+    }
+
+    node(const node&) = delete;
+    node& operator=(const node&) = delete;
+
+    virtual ~node() {
+        if (parent) {
+            parent->remove(this);
+        }
+        for (node* n : children) {
+            n->parent = nullptr;
+            n->index = -1;
+        }
+        graph.transforms().remove(transform);
+        graph.lookup().remove(indexed);
+        clear_bounds();
+        if (refit_slot >= 0) {
+            std::vector<scene::refit_entry>& r = graph.refits;
+            r[refit_slot] = r.back();
+            r[refit_slot].n->refit_slot = refit_slot;
+            r.pop_back();
+        }
+        graph.sleepers().remove(sleeping);
+    }
+
+    // The scene this node belongs to.
+    scene& get_scene() const {
+        return graph;
+    }
 
     void add(node* child) {
-        assert(child->parent == nullptr && "child already has a parent");
-        children.push_back(child);
-        child->parent = child;
+        attach(child);
+    }
+
+    // Add count children at once, growing the child list once.
+    void add(node* const* first, int count) {
+        children.reserve(children.size() + count);
+        for (int i = 0; i < count; ++i) {
+            attach(first[i]);
+        }
     }
 
     void remove(node* child) {
         assert(child->parent == this && "child doesn't belong to this node");
-        children.erase(std::remove(children.begin(), children.end(), child));
+        if (child->index < awake) {
+            swap_children(child->index, --awake);
+        }
+        swap_children(child->index, (int)children.size() - 1);
+        children.pop_back();
+        for (node* n = this; n; n = n->parent) {
+            n->descendants -= 1 + child->descendants;
+        }
+        refit();
         child->parent = nullptr;
+        child->index = -1;
+        graph.transforms().set_parent(child->transform, -1);
     }
 
-    node* find(std::function<bool(node*)> fn) const {
+    // The first direct child fn accepts. Searches further afield go through the scene's lookup().
+    template <class Fn>
+    node* find(Fn fn) const {
         auto it = std::find_if(children.begin(), children.end(), fn);
         return it == children.end() ? nullptr : *it;
     }
 
+    const std::string& name() const {
+        return graph.lookup().name(indexed.name);
+    }
+
+    void set_name(const std::string& name) {
+        graph.lookup().set_name(indexed, graph.lookup().intern(name));
+    }
+
+    // Tags are bits from the scene's lookup().tag("name").
+    bool has_tag(int tag) const {
+        return (indexed.tags >> tag & 1) != 0;
+    }
+
+    void add_tag(int tag) {
+        graph.lookup().add_tag(indexed, tag);
+    }
+
+    void remove_tag(int tag) {
+        graph.lookup().remove_tag(indexed, tag);
+    }
+
     node* get_parent() const {
         return parent;
     }
 
+    int child_count() const {
+        return (int)children.size();
+    }
+
+    // This node's id in the scene's transforms().
+    int transform_id() const {
+        return transform;
+    }
+
+    // The transform relative to the parent.
+    const affine3& local() const {
+        return graph.transforms().local(transform);
+    }
+
+    // Marks this node and everything under it for the next transforms().update().
+    void set_local(const affine3& local) {
+        graph.transforms().set_local(transform, local);
+    }
+
+    // Bounds in this node's own frame. The node goes into the scene's space() at
+    // its world transform, and update_space() keeps it there as it moves.
+    void set_bounds(const aabb& local) {
+        local_bounds = local;
+        aabb b = local.transformed(world());
+        if (proxy < 0) {
+            proxy = graph.space().insert(b, this);
+            if ((int)graph.bounded.size() <= transform) {
+                graph.bounded.resize(transform + 1, nullptr);
+            }
+            graph.bounded[transform] = this;
+        } else {
+            graph.space().move(proxy, b);
+        }
+        refit();
+    }
+
+    void clear_bounds() {
+        if (proxy >= 0) {
+            graph.space().remove(proxy);
+            proxy = -1;
+            graph.bounded[transform] = nullptr;
+            refit();
+        }
+    }
+
+    bool has_bounds() const {
+        return proxy >= 0;
+    }
+
+    const aabb& bounds() const {
+        return local_bounds;
+    }
+
+    // bounds() around world(), as of the last update_space().
+    const aabb& world_bounds() const {
+        return graph.space().bounds(proxy);
+    }
+
+    // The world bounds of this node and every node under it with bounds, as of
+    // the last update_space(); empty if none has any.
+    const aabb& subtree_bounds() const {
+        return subtree_box;
+    }
+
+    // parent world * local, cached. Only recomputed by transforms().update() when
+    // this node or one of its ancestors has moved since.
+    const affine3& world() const {
+        return graph.transforms().world(transform);
+    }
+
+    // The matrix to render this node with: world(), rewound by rs.rewind,
+    // carried into the camera relative frame of rs.
+    mat4 world_matrix(const render_state& rs) const {
+        if (rs.rewind > 0.0f) {
+            return rs.world * graph.transforms().interpolated_world(transform, 1.0f - rs.rewind).to_mat4();
+        }
+        return rs.world * world().to_mat4();
+    }
+
+    // Subtrees smaller than this are updated serially: below it the jobs cost more
+    // than they save.
+    static const int parallel_descendants = 1024;
+
+    // Update the awake children. Sleeping ones and everything under them are
+    // left out. Under update_parallel, a node with enough descendants spreads
+    // its children over the jobs.
     virtual void update(float dt) {
-        for (node* n : children) {
-            n->update(dt);
+        job_system* jobs = graph.jobs;
+        if (jobs && jobs->workers() > 0 && awake > 1 && descendants >= parallel_descendants) {
+            jobs->parallel_for(0, awake, 1, [this, dt](int begin, int end) {
+                for (int i = begin; i < end; ++i) {
+                    children[i]->update(dt);
+                }
+            });
+        } else {
+            for (int i = 0; i < awake; ++i) {
+                children[i]->update(dt);
+            }
         }
     }
 
+    // update(dt), with large sibling subtrees running concurrently on jobs.
+    // Overrides of update must then only change their own subtree: set_local is
+    // safe, adding and removing nodes is not.
+    void update_parallel(float dt, job_system& jobs) {
+        job_system* outer = graph.jobs;
+        graph.jobs = &jobs;
+        update(dt);
+        graph.jobs = outer;
+    }
+
+    // Leave this node and its subtree out of update from the next
+    // update_sleep(), until woken. Safe to call from update.
+    void sleep() {
+        graph.sleepers().sleep(sleeping);
+    }
+
+    // sleep() for seconds of the time given to update_sleep().
+    void sleep_for(float seconds) {
+        graph.sleepers().sleep_for(sleeping, seconds);
+    }
+
+    // Back into update from the next update_sleep(). Safe to call from update.
+    void wake(sleep_schedule::reason why = sleep_schedule::event) {
+        graph.sleepers().wake(sleeping, why);
+    }
+
+    bool asleep() const {
+        return sleeping.asleep;
+    }
+
+    // Draw this node alone; draw() calls it for every node it reaches. Returns
+    // whether to go on into the node's children. Nodes that set up their own
+    // state for their subtree, like cameras, draw it themselves with
+    // node::draw(their state) and return false.
+    virtual bool draw_node(const render_state&) {
+        return true;
+    }
+
+    // Draw everything under this node, parents before children. The traversal
+    // is iterative, so the render state is shared rather than copied down every
+    // level and deep hierarchies can't overflow the call stack. With rs.cull
+    // set, children whose subtree bounds are outside its frustum are skipped
+    // along with their subtrees.
     virtual void draw(render_state rs = render_state()) {
-        for (node* n : children) {
-            n->draw(rs);
+        traverse([&rs](node* n) { return n->draw_node(rs); }, rs.cull);
+    }
+
+    // Visit every node under this one depth first, parents before children and
+    // siblings in order, from an explicit stack. enter(n) handles n and returns
+    // whether to go on into its children. With cull, the subtree bounds of each
+    // node's children are tested in one batch as it is entered, and the
+    // children outside the frustum are left out with their subtrees; children
+    // with nothing bounded under them are always visited. While enter runs on one node, the next one on
+    // the stack and the node's first child are prefetched, whichever of them
+    // comes next.
+    template <class Fn>
+    void traverse(Fn enter, cull_state* cull = nullptr) {
+        std::vector<node*>& stack = traversal_stack();
+        size_t base = stack.size(); // traversals may nest; each pops back to here
+        push_children(stack, cull);
+        while (stack.size() > base) {
+            node* n = stack.back();
+            stack.pop_back();
+            if (stack.size() > base) {
+                simd::prefetch(stack.back());
+            }
+            if (!n->children.empty()) {
+                simd::prefetch(n->children.front());
+            }
+            if (cull) {
+                ++cull->stats.drawn;
+            }
+            if (enter(n)) {
+                n->push_children(stack, cull);
+            }
+        }
+    }
+
+private:
+    static std::vector<node*>& traversal_stack() {
+        static thread_local std::vector<node*> stack;
+        return stack;
+    }
+
+    // Push the children to visit, last first so they come off in order.
+    void push_children(std::vector<node*>& stack, cull_state* cull) const {
+        if (!cull) {
+            for (int i = (int)children.size() - 1; i >= 0; --i) {
+                stack.push_back(children[i]);
+            }
+            return;
+        }
+
+        static thread_local std::vector<aabb> boxes;
+        static thread_local std::vector<int> slots, visible;
+        boxes.clear();
+        slots.clear();
+        for (int i = 0; i < (int)children.size(); ++i) {
+            if (!children[i]->subtree_box.is_empty()) {
+                boxes.push_back(children[i]->subtree_box);
+                slots.push_back(i);
+            }
+        }
+        int count = (int)boxes.size();
+        visible.resize(count);
+        int passed = cull_boxes(cull->view, boxes.data(), count, visible.data());
+        cull->stats.tested += count;
+        cull->stats.culled += count - passed;
+
+        int next = passed - 1;
+        for (int i = (int)children.size() - 1; i >= 0; --i) {
+            if (!children[i]->subtree_box.is_empty()) {
+                if (next < 0 || slots[visible[next]] != i) {
+                    continue;
+                }
+                --next;
+            }
+            stack.push_back(children[i]);
         }
     }
 };
+
+// Bring every listed subtree_box up to date, deepest first so each child is
+// done before its parent. Costs as much as the listed nodes, and the children
+// of those that recompute from all of theirs.
+inline void scene::refit_subtrees() {
+    std::vector<refit_entry>& r = refits;
+    std::vector<int>& path = refit_path;
+    for (size_t i = 0; i < r.size(); ++i) {
+        int k = (int)i;
+        while (r[k].depth < 0) {
+            node* p = r[k].n->parent;
+            if (!p) {
+                r[k].depth = 0;
+                break;
+            }
+            path.push_back(k);
+            k = p->refit_slot;
+            assert(k >= 0 && "a listed node's parent isn't listed");
+        }
+        for (; !path.empty(); path.pop_back()) {
+            r[path.back()].depth = r[k].depth + 1;
+            k = path.back();
+        }
+    }
+    std::sort(r.begin(), r.end(), [](const refit_entry& a, const refit_entry& b) { return a.depth > b.depth; });
+
+    for (refit_entry& e : r) {
+        node* n = e.n;
+        if (n->refit_all) {
+            n->subtree_box = n->proxy >= 0 ? tree.bounds(n->proxy) : aabb::empty();
+            for (node* c : n->children) {
+                if (!c->subtree_box.is_empty()) {
+                    n->subtree_box.merge(c->subtree_box);
+                }
+            }
+            n->refit_all = false;
+        }
+        n->refit_slot = -1;
+        if (n->parent) {
+            n->parent->refit_moved(e.before, n->subtree_box);
+        }
+    }
+    r.clear();
+}
+
+inline void scene::update_space() {
+    for (int id : hierarchy.changed_ids()) {
+        node* n = id < (int)bounded.size() ? bounded[id] : nullptr;
+        if (n) {
+            aabb before = tree.bounds(n->proxy), after = n->local_bounds.transformed(hierarchy.world(id));
+            tree.move(n->proxy, after);
+            n->refit_moved(before, after);
+        }
+    }
+    refit_subtrees();
+}
+
+inline void scene::update_sleep(float dt) {
+    sleep.apply(dt, node::set_asleep);
+}
+
+inline void scene::wake_near(const vec3& center, float radius) {
+    tree.query(sphere{ center, radius }, [](node* n) {
+        if (n->sleeping.asleep) {
+            n->wake(sleep_schedule::proximity);
+        }
+    });
+}
+
+inline scene::sleep_stats scene::count_sleep() {
+    const sleep_schedule::stats& s = sleep.counters();
+    sleep_stats out{ s.nodes, s.nodes, s.asleep, { 0 } };
+    for (int r = 0; r < sleep_schedule::reasons; ++r) {
+        out.woken[r] = s.woken[r];
+    }
+    for (sleep_schedule::entry* e : sleep.asleep()) {
+        --out.active;
+        e->owner->traverse([&out](node* n) {
+            if (n->sleeping.asleep) {
+                return false; // counted as a sleeping node of its own
+            }
+            --out.active;
+            return true;
+        });
+    }
+    return out;
+}
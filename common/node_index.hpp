@@ -0,0 +1,239 @@
+#pragma once
+#include <cstdint>
+#include <cassert>
+#include <string>
+#include <typeindex>
+#include <typeinfo>
+#include <unordered_map>
+#include <utility>
+#include <vector>
+
+class node;
+
+// Scene-wide lookup of nodes by name, tag and type, kept up to date as nodes
+// are named, tagged, added and destroyed, so a lookup costs one hash and then
+// only touches the nodes it returns.
+//
+// Names are interned: each distinct string gets an id, hashed once. Tags are
+// interned to one of 64 bits. Nodes are filed under their exact dynamic type,
+// not its bases, the first time they are added to a parent (their type is not
+// final until their constructor has finished). Each list is unordered: a node
+// leaving one is replaced by the last, so every change is O(1).
+class node_index {
+public:
+    static const int max_tags = 64;
+
+    // A node's place in the index; a member of every node.
+    struct entry {
+        node* owner;
+        uint32_t name;                              // interned, 0 for none
+        int name_slot;
+        int type;                                   // -1 until filed
+        int type_slot;
+        uint64_t tags;                              // one bit per tag
+        std::vector<std::pair<int, int>> tag_slots; // tag, slot
+
+        explicit entry(node* owner) : owner(owner), name(0), name_slot(-1), type(-1), type_slot(-1), tags(0) { }
+    };
+
+private:
+    struct bucket {
+        std::vector<node*> nodes;
+        std::vector<entry*> entries;
+    };
+
+    std::unordered_map<std::string, uint32_t> name_ids;
+    std::vector<std::string> names; // by id; 0 is the empty name
+    std::vector<bucket> by_name;
+    std::unordered_map<std::string, int> tag_ids;
+    bucket by_tag[max_tags];
+    std::unordered_map<std::type_index, int> type_ids;
+    std::vector<bucket> by_type;
+
+    static int insert(bucket& b, entry& e) {
+        b.nodes.push_back(e.owner);
+        b.entries.push_back(&e);
+        return (int)b.nodes.size() - 1;
+    }
+
+    // Remove slot from b, filling it with the last entry; moved(e, slot) tells
+    // that entry where it went.
+    template <class Fn>
+    static void erase(bucket& b, int slot, Fn moved) {
+        int last = (int)b.nodes.size() - 1;
+        if (slot != last) {
+            b.nodes[slot] = b.nodes[last];
+            b.entries[slot] = b.entries[last];
+            moved(*b.entries[slot], slot);
+        }
+        b.nodes.pop_back();
+        b.entries.pop_back();
+    }
+
+    static int& tag_slot(entry& e, int tag) {
+        for (auto& s : e.tag_slots) {
+            if (s.first == tag) {
+                return s.second;
+            }
+        }
+        assert(false && "node doesn't have the tag");
+        return e.tag_slots[0].second;
+    }
+
+    int type_id(const std::type_info& type) {
+        auto it = type_ids.find(type);
+        if (it != type_ids.end()) {
+            return it->second;
+        }
+        by_type.emplace_back();
+        type_ids.emplace(type, (int)by_type.size() - 1);
+        return (int)by_type.size() - 1;
+    }
+
+    static const std::vector<node*>& none() {
+        static const std::vector<node*> empty;
+        return empty;
+    }
+
+public:
+    node_index() : names(1), by_name(1) { }
+
+    node_index(const node_index&) = delete;
+    node_index& operator=(const node_index&) = delete;
+
+    // The id of a name, given out the first time it is seen.
+    uint32_t intern(const std::string& name) {
+        if (name.empty()) {
+            return 0;
+        }
+        auto it = name_ids.find(name);
+        if (it != name_ids.end()) {
+            return it->second;
+        }
+        names.push_back(name);
+        by_name.emplace_back();
+        name_ids.emplace(name, (uint32_t)names.size() - 1);
+        return (uint32_t)names.size() - 1;
+    }
+
+    const std::string& name(uint32_t id) const {
+        return names[id];
+    }
+
+    // The bit of a tag, given out the first time it is seen.
+    int tag(const std::string& name) {
+        auto it = tag_ids.find(name);
+        if (it != tag_ids.end()) {
+            return it->second;
+        }
+        int t = (int)tag_ids.size();
+        assert(t < max_tags && "too many tags");
+        tag_ids.emplace(name, t);
+        return t;
+    }
+
+    void set_name(entry& e, uint32_t name) {
+        if (e.name == name) {
+            return;
+        }
+        if (e.name) {
+            erase(by_name[e.name], e.name_slot, [](entry& m, int slot) { m.name_slot = slot; });
+        }
+        e.name = name;
+        e.name_slot = name ? insert(by_name[name], e) : -1;
+    }
+
+    void add_tag(entry& e, int tag) {
+        if (e.tags >> tag & 1) {
+            return;
+        }
+        e.tags |= uint64_t(1) << tag;
+        e.tag_slots.emplace_back(tag, insert(by_tag[tag], e));
+    }
+
+    void remove_tag(entry& e, int tag) {
+        if (!(e.tags >> tag & 1)) {
+            return;
+        }
+        erase(by_tag[tag], tag_slot(e, tag), [tag](entry& m, int slot) { tag_slot(m, tag) = slot; });
+        for (size_t i = 0; i < e.tag_slots.size(); ++i) {
+            if (e.tag_slots[i].first == tag) {
+                e.tag_slots[i] = e.tag_slots.back();
+                e.tag_slots.pop_back();
+                break;
+            }
+        }
+        e.tags &= ~(uint64_t(1) << tag);
+    }
+
+    // File e under type, unless it already is.
+    void file(entry& e, const std::type_info& type) {
+        if (e.type < 0) {
+            e.type = type_id(type);
+            e.type_slot = insert(by_type[e.type], e);
+        }
+    }
+
+    // Take e out of every list, as its node goes away.
+    void remove(entry& e) {
+        set_name(e, 0);
+        while (e.tags) {
+            int t = 0;
+            while (!(e.tags >> t & 1)) {
+                ++t;
+            }
+            remove_tag(e, t);
+        }
+        if (e.type >= 0) {
+            erase(by_type[e.type], e.type_slot, [](entry& m, int slot) { m.type_slot = slot; });
+            e.type = -1;
+        }
+    }
+
+    // Every node called name, in no particular order.
+    const std::vector<node*>& named(const std::string& name) const {
+        auto it = name_ids.find(name);
+        return it == name_ids.end() ? none() : by_name[it->second].nodes;
+    }
+
+    const std::vector<node*>& named(uint32_t id) const {
+        return by_name[id].nodes;
+    }
+
+    // A node called name, or null.
+    node* find(const std::string& name) const {
+        const std::vector<node*>& n = named(name);
+        return n.empty() ? nullptr : n[0];
+    }
+
+    const std::vector<node*>& tagged(int tag) const {
+        return by_tag[tag].nodes;
+    }
+
+    // fn(node*) for every node with all the tags in mask, walking the shortest
+    // of their lists.
+    template <class Fn>
+    void each_tagged(uint64_t mask, Fn fn) const {
+        if (!mask) {
+            return;
+        }
+        const bucket* shortest = nullptr;
+        for (int t = 0; t < max_tags; ++t) {
+            if (mask >> t & 1 && (!shortest || by_tag[t].nodes.size() < shortest->nodes.size())) {
+                shortest = &by_tag[t];
+            }
+        }
+        for (size_t i = 0; i < shortest->nodes.size(); ++i) {
+            if ((shortest->entries[i]->tags & mask) == mask) {
+                fn(shortest->nodes[i]);
+            }
+        }
+    }
+
+    // Every node whose dynamic type is exactly T, once added to a parent.
+    template <class T>
+    const std::vector<node*>& of_type() const {
+        auto it = type_ids.find(typeid(T));
+        return it == type_ids.end() ? none() : by_type[it->second].nodes;
+    }
+};
@@ -0,0 +1,162 @@
+#pragma once
+#include <cstdint>
+#include <memory>
+#include <mutex>
+#include <new>
+#include <type_traits>
+#include <utility>
+#include <vector>
+#include <algorithm>
+#include "node.hpp"
+
+// Owns nodes of type T in blocks that never move, and names them by handles
+// carrying the generation of their slot. Destroying a node moves its slot's
+// generation on, so get() with an old handle returns null instead of a pointer
+// to freed or reused memory.
+//
+// Structural changes are batched into apply(), meant to run once per frame
+// outside the update. create() builds the node straight away but attaches it to
+// its parent only at the next apply(), all of one parent's new children in one
+// go; destroy() only queues, and apply() detaches each queued node in O(1)
+// before destroying it. The children of a destroyed node are detached, not
+// destroyed. destroy() may be called from concurrent updates; everything else
+// needs the pool to itself.
+template <class T>
+class node_pool {
+public:
+    struct handle {
+        uint32_t index, generation;
+
+        bool operator==(const handle& h) const { return index == h.index && generation == h.generation; }
+        bool operator!=(const handle& h) const { return !(*this == h); }
+    };
+
+private:
+    static const int block_size = 256;
+
+    struct slot {
+        typename std::aligned_storage<sizeof(T), alignof(T)>::type storage;
+        uint32_t generation;
+        bool alive;
+    };
+
+    std::vector<std::unique_ptr<slot[]>> blocks;
+    std::vector<uint32_t> free_slots;
+    uint32_t used; // slots handed out so far
+    int live;
+    std::vector<std::pair<node*, node*>> additions; // parent, child
+    std::mutex removal_mutex;
+    std::vector<handle> removals;
+
+    slot& at(uint32_t index) {
+        return blocks[index / block_size][index % block_size];
+    }
+
+    T* object(slot& s) {
+        return reinterpret_cast<T*>(&s.storage);
+    }
+
+    void release(uint32_t index) {
+        slot& s = at(index);
+        object(s)->~T();
+        s.alive = false;
+        ++s.generation;
+        free_slots.push_back(index);
+        --live;
+    }
+
+public:
+    node_pool() : used(0), live(0) { }
+
+    node_pool(const node_pool&) = delete;
+    node_pool& operator=(const node_pool&) = delete;
+
+    ~node_pool() {
+        for (uint32_t i = 0; i < used; ++i) {
+            if (at(i).alive) {
+                object(at(i))->~T();
+            }
+        }
+    }
+
+    // A new T(args...), added under parent (if any) at the next apply(). parent
+    // must still exist then.
+    template <class... Args>
+    handle create(node* parent, Args&&... args) {
+        uint32_t index;
+        if (free_slots.empty()) {
+            index = used++;
+            if (index / block_size == blocks.size()) {
+                blocks.emplace_back(new slot[block_size]);
+            }
+            at(index).generation = 0;
+        } else {
+            index = free_slots.back();
+            free_slots.pop_back();
+        }
+
+        slot& s = at(index);
+        T* n = new (&s.storage) T(std::forward<Args>(args)...);
+        s.alive = true;
+        ++live;
+        if (parent) {
+            additions.emplace_back(parent, n);
+        }
+        return handle{ index, s.generation };
+    }
+
+    // Queue h's node for destruction. Its handle goes stale at the next apply().
+    void destroy(handle h) {
+        std::lock_guard<std::mutex> lock(removal_mutex);
+        removals.push_back(h);
+    }
+
+    // The node, or null once it has been destroyed.
+    T* get(handle h) {
+        if (h.index >= used) {
+            return nullptr;
+        }
+        slot& s = at(h.index);
+        return s.alive && s.generation == h.generation ? object(s) : nullptr;
+    }
+
+    bool alive(handle h) {
+        return get(h) != nullptr;
+    }
+
+    // Live nodes, including ones still waiting to be attached.
+    int size() const {
+        return live;
+    }
+
+    // Attach the nodes created and destroy the ones queued since the last call.
+    // Nothing may be updating or drawing the nodes meanwhile.
+    void apply() {
+        if (!additions.empty()) {
+            std::stable_sort(additions.begin(), additions.end(), [](const std::pair<node*, node*>& a, const std::pair<node*, node*>& b) {
+                return a.first < b.first;
+            });
+            std::vector<node*> batch;
+            for (size_t i = 0; i < additions.size();) {
+                node* parent = additions[i].first;
+                batch.clear();
+                for (; i < additions.size() && additions[i].first == parent; ++i) {
+                    batch.push_back(additions[i].second);
+                }
+                parent->add(batch.data(), (int)batch.size());
+            }
+            additions.clear();
+        }
+
+        std::vector<handle> pending;
+        {
+            std::lock_guard<std::mutex> lock(removal_mutex);
+            pending.swap(removals);
+        }
+        for (handle h : pending) {
+            if (alive(h)) {
+                release(h.index);
+            }
+        }
+    }
+};
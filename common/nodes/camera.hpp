@@ -1,33 +1,134 @@
 #pragma once
 #include <node.hpp>
 #include <maths.hpp>
+#include <render_queue.hpp>
 #include <GL/glew.h>
 
+// position is a float offset from origin, the camera's large-world anchor. Keep
+// it small (see rebase) and move origin instead when travelling far.
+//
+// With culling on, children with bounds outside projection() * view() are not
+// drawn, and the counts for the last frame are kept in stats. With sorting on,
+// children that can submit their draws to queue do, and the queue issues them
+// once the traversal is done.
+//
+// A frame can also be split in two: extract() gathers it into a render_queue
+// without touching GL, and render() draws the queue later, on the thread with
+// the GL context. Every node drawn must then submit to rs.queue.
+//
+// The pose is kept as it was before each update too, so frames drawn between
+// fixed simulation ticks can be rewound towards it like the nodes.
 class camera : public node {
+    vec3 last_position, last_direction; // before the last update
+    bool updated;
+
 public:
+    vec3d origin;
     vec3 position, direction, up;
     float fov, aspect;
-    float near_plane, far_plane;
+    float near_plane, far_plane; // far_plane may be infinite
+    bool culling, sorting;
+    cull_stats stats;
+    render_queue queue;
+
+    explicit camera(scene& graph) : node(graph), updated(false), fov(pi / 4), aspect(1), near_plane(1), far_plane(100), culling(true), sorting(true), stats{ 0, 0, 0 } { }
+
+    vec3d eye() const {
+        return origin + to_vec3d(position);
+    }
+
+    // Folds position into origin, leaving the eye where it was.
+    void rebase() {
+        origin = eye();
+        last_position -= position;
+        position = vec3(0.0f);
+    }
 
-    camera() : fov(pi / 4), aspect(1), near_plane(1), far_plane(100) { }
+    // Move the pose before the update along, then update the children. Moving
+    // the camera belongs after the update of the same tick.
+    void update(float dt) override {
+        last_position = position;
+        last_direction = direction;
+        updated = true;
+        node::update(dt);
+    }
 
     mat4 view() const {
         return look_at(position, position + direction, up);
     }
 
     mat4 projection() const {
-        return perspective(fov, aspect, near_plane, far_plane);
+        float t = std::tan(fov / 2);
+        return std::isinf(far_plane) ? perspective_infinite_tan(t, aspect, near_plane) : perspective_tan(t, aspect, near_plane, far_plane);
+    }
+
+    // The eye sits at the render space origin. world carries things placed in the
+    // camera's own frame (relative to origin) across to it.
+    render_state frame_state(float rewind = 0.0f) const {
+        vec3 p, d;
+        pose(rewind, p, d);
+        render_state rs = render_state();
+        rs.origin = origin + to_vec3d(p);
+        rs.projection = projection();
+        rs.view = look_at(vec3(0.0f), d, up);
+        rs.world = translate(-p);
+        rs.rewind = rewind;
+        return rs;
+    }
+
+    // Draw the children into into, to be rendered later, rewound by rewind.
+    void extract(render_queue& into, float rewind = 0.0f) {
+        traverse_into(&into, rewind);
+    }
+
+    // Clear the screen and draw a queue extract() filled.
+    static void render(render_queue& from) {
+        clear();
+        from.execute();
+    }
+
+    bool draw_node(const render_state& parent) {
+        clear();
+        traverse_into(sorting ? &queue : nullptr, parent.rewind);
+        if (sorting) {
+            queue.execute();
+        }
+        return false;
     }
 
     void draw(render_state rs) {
+        draw_node(rs);
+    }
+
+private:
+    // The eye and direction rewound by rewind.
+    void pose(float rewind, vec3& p, vec3& d) const {
+        if (updated && rewind > 0.0f) {
+            p = lerp(position, last_position, rewind);
+            d = lerp(direction, last_direction, rewind);
+        } else {
+            p = position;
+            d = direction;
+        }
+    }
+
+    static void clear() {
         glClearColor(0.39f, 0.58f, 0.93f, 1.0f);
         glClear(GL_COLOR_BUFFER_BIT | GL_DEPTH_BUFFER_BIT);
+    }
 
-        rs.projection = projection();
-        rs.view = view();
-        rs.world = mat4();
-
+    void traverse_into(render_queue* q, float rewind) {
+        render_state rs = frame_state(rewind);
+        vec3 p, d;
+        pose(rewind, p, d);
+        cull_state cull{ frustum::from_matrix(projection() * look_at(p, p + d, up)), cull_stats{ 0, 0, 0 } };
+        rs.cull = culling ? &cull : nullptr;
+        rs.queue = q;
+        if (q) {
+            q->begin(rs.projection, rs.view);
+        }
         node::draw(rs);
+        stats = cull.stats;
     }
 };
 
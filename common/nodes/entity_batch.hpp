@@ -0,0 +1,39 @@
+#pragma once
+#include <functional>
+#include <node.hpp>
+#include <ecs.hpp>
+
+// Draws every entity with components Ts in one pass over the chunks, from the
+// scene graph. Entities are placed relative to this node: the render state
+// handed to the draw function has the node's world matrix folded into world, so
+// a batch under a moving ship draws its entities in the ship's frame.
+//
+// draw_chunk(rs, count, entities, components...) should set up its shader once
+// and draw the count entities from the arrays. Entities are not in the scene's
+// transforms(), so rewinding them by rs.rewind between ticks is up to
+// draw_chunk, from transforms they keep from before the tick.
+template <class... Ts>
+class entity_batch : public node {
+public:
+    typedef std::function<void(const render_state&, int, const ecs::entity*, Ts*...)> draw_function;
+
+private:
+    ecs::query<Ts...> entities;
+    draw_function draw_chunk;
+
+public:
+    entity_batch(scene& graph, ecs::world& w, draw_function draw_chunk) : node(graph), entities(w), draw_chunk(std::move(draw_chunk)) { }
+
+    int size() {
+        return entities.size();
+    }
+
+    bool draw_node(const render_state& rs) {
+        render_state local = rs;
+        local.world = world_matrix(rs);
+        entities.each_chunk([this, &local](int count, const ecs::entity* e, Ts*... components) {
+            draw_chunk(local, count, e, components...);
+        });
+        return true;
+    }
+};
@@ -2,7 +2,10 @@
 #include <node.hpp>
 #include <maths.hpp>
 #include <rendering.hpp>
+#include <render_queue.hpp>
 
+// Drawn at the far plane behind whatever is already there, so with a render
+// queue it goes last and only shades the pixels nothing else covered.
 class skybox : public node {
 
     mesh box;
@@ -11,7 +14,7 @@ class skybox : public node {
 
 public:
 
-    skybox() {
+    explicit skybox(scene& graph) : node(graph) {
         box = mesh::cube();
     }
 
@@ -27,12 +30,12 @@ public:
         cube.load_cube(front, back, top, bottom, left, right);
     }
 
-    void draw(render_state rs) {
-
+    void render(const render_state& rs) {
         mat4 v = rs.view;
         v(0, 3) = v(1, 3) = v(2, 3) = 0.0f; // Remove the movement of the camera.
 
-        glDisable(GL_DEPTH_TEST); // TODO: Some kind of state class to tidy this up.
+        glDepthFunc(GL_LEQUAL); // TODO: Some kind of state class to tidy this up.
+        glDepthMask(GL_FALSE);
 
         shader.use();
 
@@ -41,9 +44,17 @@ public:
         shader["cube"] = cube;
         box.draw(shader["albedo"], shader["roughness"], shader["metalness"]);
 
-        node::draw(rs);
+        glDepthMask(GL_TRUE);
+        glDepthFunc(GL_LESS);
+    }
 
-        glEnable(GL_DEPTH_TEST);
+    bool draw_node(const render_state& rs) {
+        if (rs.queue) {
+            rs.queue->submit(render_queue::background, [this, rs] { render(rs); });
+        } else {
+            render(rs);
+        }
+        return true;
     }
 };
 
@@ -0,0 +1,277 @@
+#pragma once
+#include <cmath>
+#include <type_traits>
+#include "simd.hpp"
+#include "vector.hpp"
+#include "matrix.hpp"
+
+// A rotation stored as a unit quaternion, (x, y, z) the vector part and w the
+// scalar part. Orientations are composed and interpolated as quaternions and
+// only expanded to a matrix when they are uploaded.
+template <class T>
+class alignas(sizeof(T) * 4 < 16 ? sizeof(T) * 4 : 16) quaternion {
+public:
+    T x, y, z, w;
+
+    // The identity rotation.
+    constexpr quaternion() : x(0), y(0), z(0), w(1) { }
+
+    constexpr quaternion(T x, T y, T z, T w) : x(x), y(y), z(z), w(w) { }
+
+    // A rotation of angle radians about a unit axis, matching rotate(angle, axis).
+    static quaternion axis_angle(const vector<T, 3>& axis, T angle) {
+        T s = std::sin(angle / 2);
+        return quaternion(axis.x * s, axis.y * s, axis.z * s, std::cos(angle / 2));
+    }
+
+    // The rotation taking +z to forward, with +y as close to up as possible.
+    static quaternion look_rotation(const vector<T, 3>& forward, const vector<T, 3>& up) {
+        vector<T, 3> z = forward.normalized();
+        vector<T, 3> x = up.cross(z).normalized();
+        vector<T, 3> y = z.cross(x);
+
+        matrix<T, 3, 3> m(std::array<T, 9>{{
+            x.x, y.x, z.x,
+            x.y, y.y, z.y,
+            x.z, y.z, z.z
+        }});
+        return from_matrix(m);
+    }
+
+    // The rotation held in an orthonormal matrix.
+    static quaternion from_matrix(const matrix<T, 3, 3>& m) {
+        T trace = m(0, 0) + m(1, 1) + m(2, 2);
+        if (trace > 0) {
+            T s = std::sqrt(trace + 1) * 2;
+            return quaternion((m(2, 1) - m(1, 2)) / s, (m(0, 2) - m(2, 0)) / s, (m(1, 0) - m(0, 1)) / s, s / 4);
+        } else if (m(0, 0) > m(1, 1) && m(0, 0) > m(2, 2)) {
+            T s = std::sqrt(1 + m(0, 0) - m(1, 1) - m(2, 2)) * 2;
+            return quaternion(s / 4, (m(0, 1) + m(1, 0)) / s, (m(0, 2) + m(2, 0)) / s, (m(2, 1) - m(1, 2)) / s);
+        } else if (m(1, 1) > m(2, 2)) {
+            T s = std::sqrt(1 + m(1, 1) - m(0, 0) - m(2, 2)) * 2;
+            return quaternion((m(0, 1) + m(1, 0)) / s, s / 4, (m(1, 2) + m(2, 1)) / s, (m(0, 2) - m(2, 0)) / s);
+        } else {
+            T s = std::sqrt(1 + m(2, 2) - m(0, 0) - m(1, 1)) * 2;
+            return quaternion((m(0, 2) + m(2, 0)) / s, (m(1, 2) + m(2, 1)) / s, s / 4, (m(1, 0) - m(0, 1)) / s);
+        }
+    }
+
+
+    T dot(const quaternion& q) const {
+        return x * q.x + y * q.y + z * q.z + w * q.w;
+    }
+
+    T lengthSquared() const {
+        return dot(*this);
+    }
+
+    T length() const {
+        return std::sqrt(lengthSquared());
+    }
+
+    void normalize() {
+        T l = length();
+        x /= l;
+        y /= l;
+        z /= l;
+        w /= l;
+    }
+
+    quaternion normalized() const {
+        quaternion q = *this;
+        q.normalize();
+        return q;
+    }
+
+    // The inverse of a unit quaternion.
+    quaternion conjugate() const {
+        return quaternion(-x, -y, -z, w);
+    }
+
+
+    // Composition, (a * b) rotates by b first and then by a.
+    quaternion& operator*=(const quaternion& q) {
+        *this = quaternion(w * q.x + x * q.w + y * q.z - z * q.y,
+                           w * q.y - x * q.z + y * q.w + z * q.x,
+                           w * q.z + x * q.y - y * q.x + z * q.w,
+                           w * q.w - x * q.x - y * q.y - z * q.z);
+        return *this;
+    }
+
+    quaternion operator*(const quaternion& q) const {
+        quaternion r = *this;
+        return r *= q;
+    }
+
+    // Rotate a vector, without expanding to a matrix.
+    vector<T, 3> operator*(const vector<T, 3>& v) const {
+        vector<T, 3> u{ x, y, z };
+        vector<T, 3> t = u.cross(v) * T(2);
+        return v + t * w + u.cross(t);
+    }
+
+
+    matrix<T, 3, 3> to_mat3() const {
+        T xx = x * x, yy = y * y, zz = z * z;
+        T xy = x * y, xz = x * z, yz = y * z;
+        T wx = w * x, wy = w * y, wz = w * z;
+        return matrix<T, 3, 3>(std::array<T, 9>{{
+            1 - 2 * (yy + zz), 2 * (xy - wz), 2 * (xz + wy),
+            2 * (xy + wz), 1 - 2 * (xx + zz), 2 * (yz - wx),
+            2 * (xz - wy), 2 * (yz + wx), 1 - 2 * (xx + yy)
+        }});
+    }
+
+    matrix<T, 4, 4> to_mat4() const {
+        matrix<T, 3, 3> r = to_mat3();
+        return matrix<T, 4, 4>(std::array<T, 16>{{
+            r(0, 0), r(0, 1), r(0, 2), 0,
+            r(1, 0), r(1, 1), r(1, 2), 0,
+            r(2, 0), r(2, 1), r(2, 2), 0,
+            0, 0, 0, 1
+        }});
+    }
+};
+
+
+#if defined(SIMD_SSE2)
+
+// r = a.w * b + a.x * (b.w, -b.z, b.y, -b.x) + a.y * (b.z, b.w, -b.x, -b.y) + a.z * (-b.y, b.x, b.w, -b.z)
+template <>
+inline quaternion<float>& quaternion<float>::operator*=(const quaternion& q) {
+    simd::float4 a = simd::load(&x), b = simd::load(&q.x);
+    simd::float4 r = simd::splat<3>(a) * b;
+    r += simd::splat<0>(a) * simd::swizzle<3, 2, 1, 0>(b) * simd::set(1, -1, 1, -1);
+    r += simd::splat<1>(a) * simd::swizzle<2, 3, 0, 1>(b) * simd::set(1, 1, -1, -1);
+    r += simd::splat<2>(a) * simd::swizzle<1, 0, 3, 2>(b) * simd::set(-1, 1, 1, -1);
+    simd::store(&x, r);
+    return *this;
+}
+
+#endif
+
+
+typedef quaternion<float> quat;
+typedef quaternion<double> quatd;
+
+static_assert(sizeof(quat) == 16 && alignof(quat) == 16, "quat must fit exactly one SIMD register");
+static_assert(std::is_trivially_copyable<quat>::value, "quat must be trivially copyable");
+
+
+template <class T>
+matrix<T, 4, 4> rotate(const quaternion<T>& q) {
+    return q.to_mat4();
+}
+
+// Normalized linear interpolation along the shortest arc. Cheap, but the angular
+// speed is not constant.
+template <class T>
+quaternion<T> nlerp(const quaternion<T>& a, const quaternion<T>& b, T t) {
+    T s = a.dot(b) < 0 ? -1 : 1;
+    quaternion<T> q(a.x + (b.x * s - a.x) * t,
+                    a.y + (b.y * s - a.y) * t,
+                    a.z + (b.z * s - a.z) * t,
+                    a.w + (b.w * s - a.w) * t);
+    return q.normalized();
+}
+
+// Spherical linear interpolation along the shortest arc, at constant angular speed.
+template <class T>
+quaternion<T> slerp(const quaternion<T>& a, const quaternion<T>& b, T t) {
+    T d = a.dot(b);
+    T s = d < 0 ? -1 : 1;
+    d *= s;
+    if (d > T(0.9995)) {
+        return nlerp(a, b, t); // nearly parallel, sin(theta) is too small to divide by
+    }
+
+    T theta = std::acos(d);
+    T sin_theta = std::sin(theta);
+    T wa = std::sin((1 - t) * theta) / sin_theta;
+    T wb = std::sin(t * theta) / sin_theta * s;
+    return quaternion<T>(a.x * wa + b.x * wb, a.y * wa + b.y * wb, a.z * wa + b.z * wb, a.w * wa + b.w * wb);
+}
+
+
+// Advance count orientations by world space angular velocities (radians per second)
+// over dt seconds and renormalize them, simd::lanes orientations per iteration.
+static void integrate(quat* orientations, const vec3* angular_velocity, int count, float dt) {
+    float* q = &orientations->x;
+    const float* av = reinterpret_cast<const float*>(angular_velocity);
+    simd::floatv h = simd::setv(dt * 0.5f);
+
+    int i = 0;
+    for (; i + simd::lanes <= count; i += simd::lanes, q += simd::lanes * 4, av += simd::lanes * 3) {
+        simd::floatv x, y, z, w, wx, wy, wz;
+        simd::load_xyzw(q, x, y, z, w);
+        simd::load_xyz(av, wx, wy, wz);
+        wx = wx * h;
+        wy = wy * h;
+        wz = wz * h;
+
+        // q += (dt / 2) * (omega, 0) * q
+        simd::floatv nx = x + (wx * w + wy * z - wz * y);
+        simd::floatv ny = y + (wy * w + wz * x - wx * z);
+        simd::floatv nz = z + (wz * w + wx * y - wy * x);
+        simd::floatv nw = w - (wx * x + wy * y + wz * z);
+
+        simd::floatv l = simd::sqrt(nx * nx + ny * ny + nz * nz + nw * nw);
+        simd::store_xyzw(q, nx / l, ny / l, nz / l, nw / l);
+    }
+
+    for (; i < count; ++i) {
+        vec3 o = angular_velocity[i] * (dt * 0.5f);
+        quat& r = orientations[i];
+        r = quat(r.x + (o.x * r.w + o.y * r.z - o.z * r.y),
+                 r.y + (o.y * r.w + o.z * r.x - o.x * r.z),
+                 r.z + (o.z * r.w + o.x * r.y - o.y * r.x),
+                 r.w - (o.x * r.x + o.y * r.y + o.z * r.z)).normalized();
+    }
+}
+
+// Expand count orientations, and optional translations, into world matrices
+// ready for upload. translations may be null.
+static void to_matrices(const quat* orientations, const vec3* translations, mat4* out, int count) {
+    const float* q = &orientations->x;
+    int i = 0;
+    for (; i + 4 <= count; i += 4, q += 16) {
+        simd::float4 x, y, z, w;
+        simd::load_xyzw(q, x, y, z, w);
+
+        simd::float4 tx = simd::zero(), ty = simd::zero(), tz = simd::zero();
+        if (translations) {
+            simd::load_xyz(translations[i].data.data(), tx, ty, tz);
+        }
+
+        simd::float4 one = simd::set1(1), two = simd::set1(2);
+        simd::float4 xx = x * x, yy = y * y, zz = z * z;
+        simd::float4 xy = x * y, xz = x * z, yz = y * z;
+        simd::float4 wx = w * x, wy = w * y, wz = w * z;
+
+        // Each row of the four matrices, one matrix per lane, transposed back to one matrix per register.
+        simd::float4 r0[4] = { one - two * (yy + zz), two * (xy - wz), two * (xz + wy), tx };
+        simd::float4 r1[4] = { two * (xy + wz), one - two * (xx + zz), two * (yz - wx), ty };
+        simd::float4 r2[4] = { two * (xz - wy), two * (yz + wx), one - two * (xx + yy), tz };
+        simd::transpose(r0[0], r0[1], r0[2], r0[3]);
+        simd::transpose(r1[0], r1[1], r1[2], r1[3]);
+        simd::transpose(r2[0], r2[1], r2[2], r2[3]);
+
+        simd::float4 r3 = simd::set(0, 0, 0, 1);
+        for (int j = 0; j < 4; ++j) {
+            float* m = out[i + j].data.data();
+            simd::store(m, r0[j]);
+            simd::store(m + 4, r1[j]);
+            simd::store(m + 8, r2[j]);
+            simd::store(m + 12, r3);
+        }
+    }
+
+    for (; i < count; ++i) {
+        out[i] = orientations[i].to_mat4();
+        if (translations) {
+            out[i](0, 3) = translations[i].x;
+            out[i](1, 3) = translations[i].y;
+            out[i](2, 3) = translations[i].z;
+        }
+    }
+}
@@ -0,0 +1,47 @@
+#pragma once
+#include <cstdint>
+#include <cstring>
+#include <utility>
+
+// A 64-bit sort key and the index of what it sorts.
+struct sort_key {
+    uint64_t key;
+    uint32_t index;
+};
+
+// Stable LSD radix sort of items by key, a byte per pass. Passes where every key
+// has the same byte are skipped, so keys that only differ in a few bytes cost
+// only those passes. scratch must have room for count items. The sorted items
+// end up back in items.
+static void radix_sort(sort_key* items, sort_key* scratch, int count) {
+    int histograms[8][256];
+    std::memset(histograms, 0, sizeof(histograms));
+    for (int i = 0; i < count; ++i) {
+        uint64_t k = items[i].key;
+        for (int b = 0; b < 8; ++b) {
+            ++histograms[b][(k >> (b * 8)) & 0xff];
+        }
+    }
+
+    sort_key* from = items;
+    sort_key* to = scratch;
+    for (int b = 0; b < 8; ++b) {
+        int* h = histograms[b];
+        if (count == 0 || h[(from[0].key >> (b * 8)) & 0xff] == count) {
+            continue;
+        }
+        int offset = 0;
+        for (int d = 0; d < 256; ++d) {
+            int n = h[d];
+            h[d] = offset;
+            offset += n;
+        }
+        for (int i = 0; i < count; ++i) {
+            to[h[(from[i].key >> (b * 8)) & 0xff]++] = from[i];
+        }
+        std::swap(from, to);
+    }
+    if (from != items) {
+        std::memcpy(items, from, sizeof(sort_key) * count);
+    }
+}
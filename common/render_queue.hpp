@@ -0,0 +1,244 @@
+#pragma once
+#include <cstring>
+#include <functional>
+#include <unordered_map>
+#include <vector>
+#include "rendering.hpp"
+#include "radix_sort.hpp"
+
+// Draw calls gathered during traversal and issued afterwards, in the order that
+// changes the least GL state: grouped by program and then by mesh part, nearest
+// first within a group. Each item is reduced to a 64-bit key,
+//
+//   layer (2 bits) | program (14) | mesh part (24) | depth (24)
+//
+// and the keys are radix sorted. Programs and parts are numbered in the order
+// they are first submitted each frame. The depth is the top bits of the
+// non-negative float distance along the view direction, whose bit patterns sort
+// like the distances do.
+//
+// Items drawn with a program need it to take the object shader's uniforms:
+// transform (the view-projection, set when the program is switched to), world,
+// normal_matrix, albedo, roughness and metalness. Anything else goes through
+// prepare(), which runs once the program is in use.
+//
+// Filling the queue touches no GL state and copies the world matrices, so a
+// filled queue is a snapshot of the frame: it can be filled on one thread and
+// executed on the one holding the GL context.
+class render_queue {
+public:
+    enum layer {
+        opaque,
+        background // after everything opaque, in the order submitted
+    };
+
+    // One frame's draws, and the state changes they took sorted and would have
+    // taken in submission order.
+    struct stats {
+        int draws;
+        int programs, arrays, materials;
+        int unsorted_programs, unsorted_arrays, unsorted_materials;
+    };
+
+private:
+    struct item {
+        gl::program* program; // null for callbacks
+        const mesh::part* part;
+        int data;             // into transforms, or into callbacks
+    };
+
+    struct program_state {
+        gl::uniform *transform, *world, *normal_matrix, *albedo, *roughness, *metalness;
+    };
+
+    std::vector<item> items;
+    std::vector<sort_key> keys, scratch;
+    std::vector<mat4> transforms;
+    std::vector<std::function<void()>> callbacks;
+    std::unordered_map<const void*, uint64_t> ids; // programs and parts, this frame
+    std::unordered_map<gl::program*, std::function<void()>> prepares; // this frame
+    std::unordered_map<gl::program*, program_state> programs;          // only touched by execute()
+    uint64_t next_program, next_part;
+    mat4 view_projection, view;
+    stats last;
+
+    uint64_t id(const void* p, uint64_t& next) {
+        auto it = ids.find(p);
+        if (it != ids.end()) {
+            return it->second;
+        }
+        ids.emplace(p, next);
+        return next++;
+    }
+
+    program_state& state(gl::program& p) {
+        auto it = programs.find(&p);
+        if (it == programs.end()) {
+            program_state s{ &p["transform"], &p["world"], &p["normal_matrix"], &p["albedo"], &p["roughness"], &p["metalness"] };
+            it = programs.emplace(&p, std::move(s)).first;
+        }
+        return it->second;
+    }
+
+    static bool same_material(const mesh::part* a, const mesh::part* b) {
+        return a && b && a->roughness == b->roughness && a->metalness == b->metalness &&
+               a->albedo.x == b->albedo.x && a->albedo.y == b->albedo.y && a->albedo.z == b->albedo.z;
+    }
+
+    // The state changes drawing items in order takes, without touching GL.
+    // Callbacks leave the state unknown.
+    template <class Fn>
+    static void count(int n, Fn at, int& programs, int& arrays, int& materials) {
+        const gl::program* program = nullptr;
+        const mesh::part* part = nullptr;
+        const mesh::part* material = nullptr;
+        programs = arrays = materials = 0;
+        for (int i = 0; i < n; ++i) {
+            const item& it = at(i);
+            if (!it.program) {
+                program = nullptr;
+                part = material = nullptr;
+                continue;
+            }
+            if (it.program != program) {
+                program = it.program;
+                part = material = nullptr;
+                ++programs;
+            }
+            if (it.part != part) {
+                part = it.part;
+                ++arrays;
+                if (!same_material(part, material)) {
+                    material = part;
+                    ++materials;
+                }
+            }
+        }
+    }
+
+public:
+    render_queue() : next_program(0), next_part(0), last{ 0, 0, 0, 0, 0, 0, 0 } { }
+
+    render_queue(const render_queue&) = delete;
+    render_queue& operator=(const render_queue&) = delete;
+
+    // Start a frame seen through view and projection, in render space.
+    void begin(const mat4& projection, const mat4& view_matrix) {
+        view_projection = projection * view_matrix;
+        view = view_matrix;
+    }
+
+    // fn sets program's other uniforms this frame, once it is in use. The last
+    // fn given for a program wins.
+    void prepare(gl::program& program, std::function<void()> fn) {
+        prepares[&program] = std::move(fn);
+    }
+
+    // The depth field of the key for an item at world seen through view: the
+    // distance of its origin along the view direction, look_at's +z. Anything
+    // behind the eye counts as 0.
+    static uint32_t depth_bits(const mat4& view, const mat4& world) {
+        float depth = view(2, 0) * world(0, 3) + view(2, 1) * world(1, 3) + view(2, 2) * world(2, 3) + view(2, 3);
+        uint32_t bits = 0;
+        if (depth > 0.0f) {
+            std::memcpy(&bits, &depth, sizeof(bits));
+        }
+        return bits >> 8;
+    }
+
+    // The sort key of an opaque item from its program and part numbers and
+    // depth_bits.
+    static uint64_t opaque_key(uint64_t program, uint64_t part, uint32_t depth) {
+        return uint64_t(opaque) << 62 | (program & 0x3fff) << 48 | (part & 0xffffff) << 24 | depth;
+    }
+
+    // Every part of m drawn with program at world, a render space matrix.
+    void submit(gl::program& program, const mesh& m, const mat4& world) {
+        uint64_t p = id(&program, next_program);
+        uint32_t depth = depth_bits(view, world);
+
+        int t = (int)transforms.size();
+        transforms.push_back(world);
+        for (const mesh::part& part : m.parts) {
+            uint64_t key = opaque_key(p, id(&part, next_part), depth);
+            keys.push_back(sort_key{ key, (uint32_t)items.size() });
+            items.push_back(item{ &program, &part, t });
+        }
+    }
+
+    // fn at its turn in layer l, for draws that don't fit the items above, like
+    // the skybox. Afterwards the queue assumes nothing about GL state.
+    void submit(layer l, std::function<void()> fn) {
+        keys.push_back(sort_key{ uint64_t(l) << 62 | items.size(), (uint32_t)items.size() });
+        items.push_back(item{ nullptr, nullptr, (int)callbacks.size() });
+        callbacks.push_back(std::move(fn));
+    }
+
+    // Sort and issue everything submitted since begin(), and start over.
+    const stats& execute() {
+        int n = (int)keys.size();
+        scratch.resize(n);
+        radix_sort(keys.data(), scratch.data(), n);
+
+        last = stats{ 0, 0, 0, 0, 0, 0, 0 };
+        count(n, [this](int i) -> const item& { return items[i]; }, last.unsorted_programs, last.unsorted_arrays, last.unsorted_materials);
+
+        gl::program* program = nullptr;
+        program_state* s = nullptr;
+        const mesh::part* part = nullptr;
+        const mesh::part* material = nullptr;
+        for (const sort_key& k : keys) {
+            const item& it = items[k.index];
+            if (!it.program) {
+                callbacks[it.data]();
+                program = nullptr;
+                part = material = nullptr;
+                continue;
+            }
+
+            if (it.program != program) {
+                program = it.program;
+                program->use();
+                s = &state(*program);
+                *s->transform = view_projection;
+                auto prepare = prepares.find(program);
+                if (prepare != prepares.end()) {
+                    prepare->second();
+                }
+                part = material = nullptr;
+                ++last.programs;
+            }
+            if (it.part != part) {
+                part = it.part;
+                part->object.bind();
+                ++last.arrays;
+                if (!same_material(part, material)) {
+                    material = part;
+                    *s->albedo = part->albedo;
+                    *s->roughness = part->roughness;
+                    *s->metalness = part->metalness;
+                    ++last.materials;
+                }
+            }
+
+            const mat4& world = transforms[it.data];
+            *s->world = world;
+            *s->normal_matrix = affine3(world).normal_matrix();
+            glDrawArrays(GL_TRIANGLES, 0, part->vertices);
+            ++last.draws;
+        }
+
+        items.clear();
+        keys.clear();
+        transforms.clear();
+        callbacks.clear();
+        prepares.clear();
+        ids.clear();
+        next_program = next_part = 0;
+        return last;
+    }
+
+    const stats& last_frame() const {
+        return last;
+    }
+};
@@ -7,7 +7,7 @@
 #include <assimp/scene.h>
 #include <assimp/postprocess.h>
 
-void mesh::load_file(const std::string& filename) {
+void mesh::load_file(const std::string& filename, const mat4& transform) {
     Assimp::Importer importer;
     const aiScene* scene = importer.ReadFile(filename.c_str(), aiProcess_Triangulate | aiProcess_JoinIdenticalVertices | aiProcess_ConvertToLeftHanded | aiProcess_ImproveCacheLocality);
     assert(scene && "Error loading mesh from file");
@@ -26,6 +26,18 @@ void mesh::load_file(const std::string& filename) {
             }
         }
 
+        transform_points(transform, verts.data(), verts.data(), (int)verts.size());
+        // Normals go through the inverse transpose, which keeps them perpendicular
+        // to the surface under non-uniform scale and shear.
+        mat4 normal_transform = affine3(inverse_transpose(affine3(transform).linear()), vec3(0.0f)).to_mat4();
+        transform_directions(normal_transform, normals.data(), normals.data(), (int)normals.size());
+        for (vec3& n : normals) {
+            n.normalize();
+        }
+        for (const vec3& v : verts) {
+            bounds.merge(v);
+        }
+
         part p;
         p.vertices = verts.size();
         p.add_buffer(verts, 3, GL_FLOAT, false);
@@ -54,6 +66,7 @@ void mesh::generate_part(const std::vector<vec3>& vertices, const std::vector<ve
     for (const auto& i : indices) {
         v.push_back(vertices[i.first]);
         n.push_back(normals[i.second]);
+        bounds.merge(vertices[i.first]);
     }
 
     p.vertices = indices.size();
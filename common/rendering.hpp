@@ -128,6 +128,10 @@ namespace gl {
             glUniformMatrix4fv(id, 1, true, m.data.data());
         }
 
+        void set(const mat3& m) {
+            glUniformMatrix3fv(id, 1, true, m.data.data());
+        }
+
         void set(float x) {
             glUniform1f(id, x);
         }
@@ -333,25 +337,27 @@ struct mesh {
     };
 
     std::vector<part> parts;
+    aabb bounds; // around every part's vertices
 
     // create a new empty mesh object
-    mesh() { }
+    mesh() : bounds(aabb::empty()) { }
 
     // create a new mesh object from a file
-    mesh(const std::string& filename) {
-        load_file(filename);
+    mesh(const std::string& filename, const mat4& transform = mat4()) : bounds(aabb::empty()) {
+        load_file(filename, transform);
     }
 
-    mesh(mesh&& move) {
+    mesh(mesh&& move) : bounds(move.bounds) {
         std::swap(parts, move.parts);
     }
 
     void operator=(mesh&& move) {
         std::swap(parts, move.parts);
+        std::swap(bounds, move.bounds);
     }
 
-    // Load a model from a file
-    void load_file(const std::string& filename);
+    // Load a model from a file, baking transform into the vertices and normals
+    void load_file(const std::string& filename, const mat4& transform = mat4());
 
     // Generate a model from a list of vertices, a list of normals, and a list of indices. Each index is a pair into the list of vertices and list of normals. The indices are read in threes to generate trigangles.
     void generate_part(const std::vector<vec3>& vertices, const std::vector<vec3>& normals, const std::vector<std::pair<int, int>>& indices, const vec3& albedo, float roughness, float metalness);
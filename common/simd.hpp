@@ -0,0 +1,373 @@
+#pragma once
+
+// Compile time selection of the instruction set used by the maths library.
+// SSE2 is picked up automatically on any x86-64 compiler, AVX when the compiler
+// is told to target it (see the ENABLE_AVX option). Define SIMD_SCALAR to force
+// the portable fallback everywhere.
+#if !defined(SIMD_SCALAR)
+#   if defined(__AVX__)
+#       define SIMD_AVX 1
+#   endif
+#   if defined(__SSE2__) || defined(_M_X64) || (defined(_M_IX86_FP) && _M_IX86_FP >= 2)
+#       define SIMD_SSE2 1
+#   endif
+#endif
+
+#if defined(SIMD_AVX)
+#   include <immintrin.h>
+#elif defined(SIMD_SSE2)
+#   include <emmintrin.h>
+#endif
+
+#include <cmath>
+#include <algorithm>
+
+namespace simd {
+
+#if defined(SIMD_AVX)
+    static const char* const name = "avx";
+#elif defined(SIMD_SSE2)
+    static const char* const name = "sse2";
+#else
+    static const char* const name = "scalar";
+#endif
+
+    // Hint that the cache line holding p is about to be read.
+    inline void prefetch(const void* p) {
+#if defined(SIMD_SSE2)
+        _mm_prefetch(static_cast<const char*>(p), _MM_HINT_T0);
+#else
+        (void)p;
+#endif
+    }
+
+    // Four packed floats. Wraps the native register type so we can give it operators.
+    struct float4 {
+#if defined(SIMD_SSE2)
+        __m128 v;
+#else
+        float v[4];
+#endif
+    };
+
+#if defined(SIMD_SSE2)
+
+    inline float4 set(float x, float y, float z, float w) { return { _mm_setr_ps(x, y, z, w) }; }
+    inline float4 set1(float x) { return { _mm_set1_ps(x) }; }
+    inline float4 zero() { return { _mm_setzero_ps() }; }
+
+    inline float4 load(const float* p) { return { _mm_load_ps(p) }; }
+    inline float4 loadu(const float* p) { return { _mm_loadu_ps(p) }; }
+    inline void store(float* p, float4 a) { _mm_store_ps(p, a.v); }
+    inline void storeu(float* p, float4 a) { _mm_storeu_ps(p, a.v); }
+
+    // Load/store exactly three floats, the fourth lane is zeroed. Never touches memory past p[2].
+    inline float4 load3(const float* p) {
+        __m128 xy = _mm_castsi128_ps(_mm_loadl_epi64(reinterpret_cast<const __m128i*>(p)));
+        return { _mm_movelh_ps(xy, _mm_load_ss(p + 2)) };
+    }
+
+    inline void store3(float* p, float4 a) {
+        _mm_storel_epi64(reinterpret_cast<__m128i*>(p), _mm_castps_si128(a.v));
+        _mm_store_ss(p + 2, _mm_movehl_ps(a.v, a.v));
+    }
+
+    inline float4 operator+(float4 a, float4 b) { return { _mm_add_ps(a.v, b.v) }; }
+    inline float4 operator-(float4 a, float4 b) { return { _mm_sub_ps(a.v, b.v) }; }
+    inline float4 operator*(float4 a, float4 b) { return { _mm_mul_ps(a.v, b.v) }; }
+    inline float4 operator/(float4 a, float4 b) { return { _mm_div_ps(a.v, b.v) }; }
+    inline float4 operator-(float4 a) { return { _mm_xor_ps(a.v, _mm_set1_ps(-0.0f)) }; }
+
+    inline float4 min(float4 a, float4 b) { return { _mm_min_ps(a.v, b.v) }; }
+    inline float4 max(float4 a, float4 b) { return { _mm_max_ps(a.v, b.v) }; }
+    inline float4 sqrt(float4 a) { return { _mm_sqrt_ps(a.v) }; }
+
+    // Broadcast lane I of a to every lane.
+    template <int I>
+    inline float4 splat(float4 a) { return { _mm_shuffle_ps(a.v, a.v, _MM_SHUFFLE(I, I, I, I)) }; }
+
+    // Sum of all four lanes, broadcast to every lane.
+    inline float4 hsum(float4 a) {
+        __m128 s = _mm_add_ps(a.v, _mm_shuffle_ps(a.v, a.v, _MM_SHUFFLE(2, 3, 0, 1)));
+        return { _mm_add_ps(s, _mm_shuffle_ps(s, s, _MM_SHUFFLE(1, 0, 3, 2))) };
+    }
+
+    inline float first(float4 a) { return _mm_cvtss_f32(a.v); }
+
+    // (a.y, a.z, a.x, a.w), the building block of a cross product.
+    inline float4 yzxw(float4 a) { return { _mm_shuffle_ps(a.v, a.v, _MM_SHUFFLE(3, 0, 2, 1)) }; }
+
+    // (a[X], a[Y], a[Z], a[W])
+    template <int X, int Y, int Z, int W>
+    inline float4 swizzle(float4 a) { return { _mm_shuffle_ps(a.v, a.v, _MM_SHUFFLE(W, Z, Y, X)) }; }
+
+    inline float4 abs(float4 a) { return { _mm_andnot_ps(_mm_set1_ps(-0.0f), a.v) }; }
+
+    // Comparisons give a lane mask, combined with & and | and read back with mask().
+    inline float4 operator<(float4 a, float4 b) { return { _mm_cmplt_ps(a.v, b.v) }; }
+    inline float4 operator<=(float4 a, float4 b) { return { _mm_cmple_ps(a.v, b.v) }; }
+    inline float4 operator>(float4 a, float4 b) { return { _mm_cmpgt_ps(a.v, b.v) }; }
+    inline float4 operator>=(float4 a, float4 b) { return { _mm_cmpge_ps(a.v, b.v) }; }
+    inline float4 operator&(float4 a, float4 b) { return { _mm_and_ps(a.v, b.v) }; }
+    inline float4 operator|(float4 a, float4 b) { return { _mm_or_ps(a.v, b.v) }; }
+
+    // One bit per lane, lane 0 in bit 0.
+    inline int mask(float4 a) { return _mm_movemask_ps(a.v); }
+
+    // Lanes of a where m is set, of b elsewhere.
+    inline float4 select(float4 m, float4 a, float4 b) { return { _mm_or_ps(_mm_and_ps(m.v, a.v), _mm_andnot_ps(m.v, b.v)) }; }
+
+    // Hardware estimate of 1 / sqrt(a), relative error below 1.5 * 2^-12.
+    inline float4 rsqrt(float4 a) { return { _mm_rsqrt_ps(a.v) }; }
+
+    // (a.x, a.z, b.x, b.z) and (a.y, a.w, b.y, b.w)
+    inline void deinterleave(float4 a, float4 b, float4& even, float4& odd) {
+        even.v = _mm_shuffle_ps(a.v, b.v, _MM_SHUFFLE(2, 0, 2, 0));
+        odd.v = _mm_shuffle_ps(a.v, b.v, _MM_SHUFFLE(3, 1, 3, 1));
+    }
+
+#else
+
+    inline float4 set(float x, float y, float z, float w) { return { { x, y, z, w } }; }
+    inline float4 set1(float x) { return { { x, x, x, x } }; }
+    inline float4 zero() { return set1(0.0f); }
+
+    inline float4 load(const float* p) { return { { p[0], p[1], p[2], p[3] } }; }
+    inline float4 loadu(const float* p) { return load(p); }
+    inline void store(float* p, float4 a) { for (int i = 0; i < 4; ++i) p[i] = a.v[i]; }
+    inline void storeu(float* p, float4 a) { store(p, a); }
+
+    inline float4 load3(const float* p) { return { { p[0], p[1], p[2], 0.0f } }; }
+    inline void store3(float* p, float4 a) { for (int i = 0; i < 3; ++i) p[i] = a.v[i]; }
+
+    inline float4 operator+(float4 a, float4 b) { return { { a.v[0] + b.v[0], a.v[1] + b.v[1], a.v[2] + b.v[2], a.v[3] + b.v[3] } }; }
+    inline float4 operator-(float4 a, float4 b) { return { { a.v[0] - b.v[0], a.v[1] - b.v[1], a.v[2] - b.v[2], a.v[3] - b.v[3] } }; }
+    inline float4 operator*(float4 a, float4 b) { return { { a.v[0] * b.v[0], a.v[1] * b.v[1], a.v[2] * b.v[2], a.v[3] * b.v[3] } }; }
+    inline float4 operator/(float4 a, float4 b) { return { { a.v[0] / b.v[0], a.v[1] / b.v[1], a.v[2] / b.v[2], a.v[3] / b.v[3] } }; }
+    inline float4 operator-(float4 a) { return { { -a.v[0], -a.v[1], -a.v[2], -a.v[3] } }; }
+
+    inline float4 min(float4 a, float4 b) { return { { std::min(a.v[0], b.v[0]), std::min(a.v[1], b.v[1]), std::min(a.v[2], b.v[2]), std::min(a.v[3], b.v[3]) } }; }
+    inline float4 max(float4 a, float4 b) { return { { std::max(a.v[0], b.v[0]), std::max(a.v[1], b.v[1]), std::max(a.v[2], b.v[2]), std::max(a.v[3], b.v[3]) } }; }
+    inline float4 sqrt(float4 a) { return { { std::sqrt(a.v[0]), std::sqrt(a.v[1]), std::sqrt(a.v[2]), std::sqrt(a.v[3]) } }; }
+
+    template <int I>
+    inline float4 splat(float4 a) { return set1(a.v[I]); }
+
+    inline float4 hsum(float4 a) { return set1(a.v[0] + a.v[1] + a.v[2] + a.v[3]); }
+
+    inline float first(float4 a) { return a.v[0]; }
+
+    inline float4 yzxw(float4 a) { return { { a.v[1], a.v[2], a.v[0], a.v[3] } }; }
+
+    template <int X, int Y, int Z, int W>
+    inline float4 swizzle(float4 a) { return { { a.v[X], a.v[Y], a.v[Z], a.v[W] } }; }
+
+    inline float4 abs(float4 a) { return { { std::fabs(a.v[0]), std::fabs(a.v[1]), std::fabs(a.v[2]), std::fabs(a.v[3]) } }; }
+
+    // Masks hold 1 or 0 per lane here, which & and | preserve.
+    inline float4 operator<(float4 a, float4 b) { return { { float(a.v[0] < b.v[0]), float(a.v[1] < b.v[1]), float(a.v[2] < b.v[2]), float(a.v[3] < b.v[3]) } }; }
+    inline float4 operator<=(float4 a, float4 b) { return { { float(a.v[0] <= b.v[0]), float(a.v[1] <= b.v[1]), float(a.v[2] <= b.v[2]), float(a.v[3] <= b.v[3]) } }; }
+    inline float4 operator>(float4 a, float4 b) { return b < a; }
+    inline float4 operator>=(float4 a, float4 b) { return b <= a; }
+    inline float4 operator&(float4 a, float4 b) { return a * b; }
+    inline float4 operator|(float4 a, float4 b) { return max(a, b); }
+
+    inline int mask(float4 a) { return (a.v[0] != 0) | (a.v[1] != 0) << 1 | (a.v[2] != 0) << 2 | (a.v[3] != 0) << 3; }
+
+    inline float4 select(float4 m, float4 a, float4 b) { return { { m.v[0] != 0 ? a.v[0] : b.v[0], m.v[1] != 0 ? a.v[1] : b.v[1], m.v[2] != 0 ? a.v[2] : b.v[2], m.v[3] != 0 ? a.v[3] : b.v[3] } }; }
+
+    // Exact here, there is no estimate instruction to use.
+    inline float4 rsqrt(float4 a) { return { { 1 / std::sqrt(a.v[0]), 1 / std::sqrt(a.v[1]), 1 / std::sqrt(a.v[2]), 1 / std::sqrt(a.v[3]) } }; }
+
+    inline void deinterleave(float4 a, float4 b, float4& even, float4& odd) {
+        even = set(a.v[0], a.v[2], b.v[0], b.v[2]);
+        odd = set(a.v[1], a.v[3], b.v[1], b.v[3]);
+    }
+
+#endif
+
+    inline float4& operator+=(float4& a, float4 b) { return a = a + b; }
+    inline float4& operator-=(float4& a, float4 b) { return a = a - b; }
+    inline float4& operator*=(float4& a, float4 b) { return a = a * b; }
+    inline float4& operator/=(float4& a, float4 b) { return a = a / b; }
+
+    // Dot product of the first three lanes, broadcast to every lane.
+    inline float4 dot3(float4 a, float4 b) {
+#if defined(SIMD_AVX)
+        return { _mm_dp_ps(a.v, b.v, 0x7f) };
+#else
+        float4 m = a * b;
+        return splat<0>(m) + splat<1>(m) + splat<2>(m);
+#endif
+    }
+
+    // Dot product of all four lanes, broadcast to every lane.
+    inline float4 dot4(float4 a, float4 b) {
+#if defined(SIMD_AVX)
+        return { _mm_dp_ps(a.v, b.v, 0xff) };
+#else
+        return hsum(a * b);
+#endif
+    }
+
+    // Transpose four rows held in registers into four columns, in place.
+    inline void transpose(float4& a, float4& b, float4& c, float4& d) {
+#if defined(SIMD_SSE2)
+        _MM_TRANSPOSE4_PS(a.v, b.v, c.v, d.v);
+#else
+        float4 r[4] = { a, b, c, d };
+        a = set(r[0].v[0], r[1].v[0], r[2].v[0], r[3].v[0]);
+        b = set(r[0].v[1], r[1].v[1], r[2].v[1], r[3].v[1]);
+        c = set(r[0].v[2], r[1].v[2], r[2].v[2], r[3].v[2]);
+        d = set(r[0].v[3], r[1].v[3], r[2].v[3], r[3].v[3]);
+#endif
+    }
+
+    // Cross product of the first three lanes, the fourth lane is zero if both inputs had w == 0.
+    inline float4 cross3(float4 a, float4 b) {
+        return yzxw(a * yzxw(b) - yzxw(a) * b);
+    }
+
+    // Deinterleave four packed vec3s (12 floats) into x, y and z registers, and back.
+    inline void load_xyz(const float* p, float4& x, float4& y, float4& z) {
+#if defined(SIMD_SSE2)
+        __m128 a = _mm_loadu_ps(p), b = _mm_loadu_ps(p + 4), c = _mm_loadu_ps(p + 8);
+        x.v = _mm_shuffle_ps(a, _mm_shuffle_ps(b, c, _MM_SHUFFLE(1, 1, 2, 2)), _MM_SHUFFLE(2, 0, 3, 0));
+        y.v = _mm_shuffle_ps(_mm_shuffle_ps(a, b, _MM_SHUFFLE(0, 0, 1, 1)), _mm_shuffle_ps(b, c, _MM_SHUFFLE(2, 2, 3, 3)), _MM_SHUFFLE(2, 0, 2, 0));
+        z.v = _mm_shuffle_ps(_mm_shuffle_ps(a, b, _MM_SHUFFLE(1, 1, 2, 2)), c, _MM_SHUFFLE(3, 0, 2, 0));
+#else
+        x = set(p[0], p[3], p[6], p[9]);
+        y = set(p[1], p[4], p[7], p[10]);
+        z = set(p[2], p[5], p[8], p[11]);
+#endif
+    }
+
+    inline void store_xyz(float* p, float4 x, float4 y, float4 z) {
+#if defined(SIMD_SSE2)
+        __m128 a = _mm_shuffle_ps(_mm_shuffle_ps(x.v, y.v, 0), _mm_shuffle_ps(z.v, x.v, _MM_SHUFFLE(1, 1, 0, 0)), _MM_SHUFFLE(2, 0, 2, 0));
+        __m128 b = _mm_shuffle_ps(_mm_shuffle_ps(y.v, z.v, _MM_SHUFFLE(1, 1, 1, 1)), _mm_shuffle_ps(x.v, y.v, _MM_SHUFFLE(2, 2, 2, 2)), _MM_SHUFFLE(2, 0, 2, 0));
+        __m128 c = _mm_shuffle_ps(_mm_shuffle_ps(z.v, x.v, _MM_SHUFFLE(3, 3, 2, 2)), _mm_shuffle_ps(y.v, z.v, _MM_SHUFFLE(3, 3, 3, 3)), _MM_SHUFFLE(2, 0, 2, 0));
+        _mm_storeu_ps(p, a);
+        _mm_storeu_ps(p + 4, b);
+        _mm_storeu_ps(p + 8, c);
+#else
+        for (int i = 0; i < 4; ++i) {
+            p[i * 3 + 0] = x.v[i];
+            p[i * 3 + 1] = y.v[i];
+            p[i * 3 + 2] = z.v[i];
+        }
+#endif
+    }
+
+    // Deinterleave four packed vec4s into x, y, z and w registers.
+    inline void load_xyzw(const float* p, float4& x, float4& y, float4& z, float4& w) {
+        x = loadu(p);
+        y = loadu(p + 4);
+        z = loadu(p + 8);
+        w = loadu(p + 12);
+        transpose(x, y, z, w);
+    }
+
+    // Interleave four x, y, z, w registers into four packed vec4s.
+    inline void store_xyzw(float* p, float4 x, float4 y, float4 z, float4 w) {
+        transpose(x, y, z, w);
+        storeu(p, x);
+        storeu(p + 4, y);
+        storeu(p + 8, z);
+        storeu(p + 12, w);
+    }
+
+
+#if defined(SIMD_AVX)
+
+    // Eight packed floats, only available when compiling for AVX.
+    struct float8 {
+        __m256 v;
+    };
+
+    inline float8 setv(float x) { return { _mm256_set1_ps(x) }; }
+    inline float8 loadv(const float* p) { return { _mm256_loadu_ps(p) }; }
+    inline void storev(float* p, float8 a) { _mm256_storeu_ps(p, a.v); }
+
+    inline float8 operator+(float8 a, float8 b) { return { _mm256_add_ps(a.v, b.v) }; }
+    inline float8 operator-(float8 a, float8 b) { return { _mm256_sub_ps(a.v, b.v) }; }
+    inline float8 operator*(float8 a, float8 b) { return { _mm256_mul_ps(a.v, b.v) }; }
+    inline float8 operator/(float8 a, float8 b) { return { _mm256_div_ps(a.v, b.v) }; }
+    inline float8 operator-(float8 a) { return { _mm256_xor_ps(a.v, _mm256_set1_ps(-0.0f)) }; }
+
+    inline float8 min(float8 a, float8 b) { return { _mm256_min_ps(a.v, b.v) }; }
+    inline float8 max(float8 a, float8 b) { return { _mm256_max_ps(a.v, b.v) }; }
+    inline float8 sqrt(float8 a) { return { _mm256_sqrt_ps(a.v) }; }
+
+    inline float8 abs(float8 a) { return { _mm256_andnot_ps(_mm256_set1_ps(-0.0f), a.v) }; }
+
+    inline float8 operator<(float8 a, float8 b) { return { _mm256_cmp_ps(a.v, b.v, _CMP_LT_OQ) }; }
+    inline float8 operator<=(float8 a, float8 b) { return { _mm256_cmp_ps(a.v, b.v, _CMP_LE_OQ) }; }
+    inline float8 operator>(float8 a, float8 b) { return { _mm256_cmp_ps(a.v, b.v, _CMP_GT_OQ) }; }
+    inline float8 operator>=(float8 a, float8 b) { return { _mm256_cmp_ps(a.v, b.v, _CMP_GE_OQ) }; }
+    inline float8 operator&(float8 a, float8 b) { return { _mm256_and_ps(a.v, b.v) }; }
+    inline float8 operator|(float8 a, float8 b) { return { _mm256_or_ps(a.v, b.v) }; }
+
+    inline int mask(float8 a) { return _mm256_movemask_ps(a.v); }
+
+    inline float8 select(float8 m, float8 a, float8 b) { return { _mm256_blendv_ps(b.v, a.v, m.v) }; }
+
+    inline float8 rsqrt(float8 a) { return { _mm256_rsqrt_ps(a.v) }; }
+
+    inline float8 combine(float4 lo, float4 hi) { return { _mm256_set_m128(hi.v, lo.v) }; }
+    inline float4 low(float8 a) { return { _mm256_castps256_ps128(a.v) }; }
+    inline float4 high(float8 a) { return { _mm256_extractf128_ps(a.v, 1) }; }
+
+    // Even and odd lanes of a followed by those of b, in order.
+    inline void deinterleave(float8 a, float8 b, float8& even, float8& odd) {
+        float4 e0, o0, e1, o1;
+        deinterleave(low(a), high(a), e0, o0);
+        deinterleave(low(b), high(b), e1, o1);
+        even = combine(e0, e1);
+        odd = combine(o0, o1);
+    }
+
+    inline void load_xyz(const float* p, float8& x, float8& y, float8& z) {
+        float4 x0, y0, z0, x1, y1, z1;
+        load_xyz(p, x0, y0, z0);
+        load_xyz(p + 12, x1, y1, z1);
+        x = combine(x0, x1);
+        y = combine(y0, y1);
+        z = combine(z0, z1);
+    }
+
+    inline void store_xyz(float* p, float8 x, float8 y, float8 z) {
+        store_xyz(p, low(x), low(y), low(z));
+        store_xyz(p + 12, high(x), high(y), high(z));
+    }
+
+    inline void load_xyzw(const float* p, float8& x, float8& y, float8& z, float8& w) {
+        float4 x0, y0, z0, w0, x1, y1, z1, w1;
+        load_xyzw(p, x0, y0, z0, w0);
+        load_xyzw(p + 16, x1, y1, z1, w1);
+        x = combine(x0, x1);
+        y = combine(y0, y1);
+        z = combine(z0, z1);
+        w = combine(w0, w1);
+    }
+
+    inline void store_xyzw(float* p, float8 x, float8 y, float8 z, float8 w) {
+        store_xyzw(p, low(x), low(y), low(z), low(w));
+        store_xyzw(p + 16, high(x), high(y), high(z), high(w));
+    }
+
+    // The widest register available, used by the batch kernels.
+    typedef float8 floatv;
+
+#else
+
+    inline float4 setv(float x) { return set1(x); }
+    inline float4 loadv(const float* p) { return loadu(p); }
+    inline void storev(float* p, float4 a) { storeu(p, a); }
+
+    typedef float4 floatv;
+
+#endif
+
+    static const int lanes = sizeof(floatv) / sizeof(float);
+}
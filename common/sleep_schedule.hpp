@@ -0,0 +1,227 @@
+#pragma once
+#include <mutex>
+#include <utility>
+#include <vector>
+
+class node;
+
+// Which nodes are asleep, and when and why they wake. A sleeping node is left
+// out of update along with everything under it; it is still drawn.
+//
+// sleep() and wake() may be called from concurrent updates, so they only record
+// a request. apply() carries the requests out once per frame, outside the
+// update, together with the timers that have come due; the node tree is only
+// rearranged there. Requests made in the same frame replace each other, so the
+// last one wins. Timers are a binary heap ordered by wake time, and every list
+// here is unordered with O(1) removal, so nodes that stay asleep cost nothing.
+class sleep_schedule {
+public:
+    enum reason {
+        event,     // wake() called by the game
+        timer,     // the time given to sleep_for() ran out
+        proximity, // something came near it
+        reasons
+    };
+
+    // A node's place in the schedule; a member of every node.
+    struct entry {
+        node* owner;
+        bool asleep;      // as of the last apply()
+        bool requested;   // whether to be asleep after the next apply()
+        reason why;       // for a requested wake
+        int pending_slot; // -1 when no request is waiting
+        int timer_slot;   // -1 without a timer
+        int asleep_slot;
+        double wake_time;      // the key in timers; only apply() changes it
+        double requested_wake; // for a requested sleep, -1 for none
+
+        explicit entry(node* owner) : owner(owner), asleep(false), requested(false), why(event), pending_slot(-1),
+                                      timer_slot(-1), asleep_slot(-1), wake_time(0.0), requested_wake(-1.0) { }
+    };
+
+    // Nodes in existence and the wakes so far, by reason.
+    struct stats {
+        int nodes, asleep;
+        int woken[reasons];
+    };
+
+private:
+    std::mutex request_mutex;
+    std::vector<entry*> pending, timers, sleeping;
+    double now;
+    stats counts;
+
+    static void erase(std::vector<entry*>& list, int& slot, int entry::*slot_of) {
+        entry* last = list.back();
+        list[slot] = last;
+        last->*slot_of = slot;
+        list.pop_back();
+        slot = -1;
+    }
+
+    void request(entry& e, bool asleep, reason why) {
+        e.requested = asleep;
+        e.why = why;
+        if (e.pending_slot < 0) {
+            e.pending_slot = (int)pending.size();
+            pending.push_back(&e);
+        }
+    }
+
+    bool earlier(int a, int b) const {
+        return timers[a]->wake_time < timers[b]->wake_time;
+    }
+
+    void swap_timers(int a, int b) {
+        std::swap(timers[a], timers[b]);
+        timers[a]->timer_slot = a;
+        timers[b]->timer_slot = b;
+    }
+
+    void sift_up(int i) {
+        while (i > 0 && earlier(i, (i - 1) / 2)) {
+            swap_timers(i, (i - 1) / 2);
+            i = (i - 1) / 2;
+        }
+    }
+
+    void sift_down(int i) {
+        int n = (int)timers.size();
+        for (;;) {
+            int first = i;
+            int l = 2 * i + 1, r = 2 * i + 2;
+            if (l < n && earlier(l, first)) {
+                first = l;
+            }
+            if (r < n && earlier(r, first)) {
+                first = r;
+            }
+            if (first == i) {
+                return;
+            }
+            swap_timers(i, first);
+            i = first;
+        }
+    }
+
+    void cancel_timer(entry& e) {
+        if (e.timer_slot < 0) {
+            return;
+        }
+        int i = e.timer_slot;
+        int last = (int)timers.size() - 1;
+        if (i != last) {
+            swap_timers(i, last);
+        }
+        timers.pop_back();
+        e.timer_slot = -1;
+        if (i < (int)timers.size()) {
+            sift_down(i);
+            sift_up(i);
+        }
+    }
+
+    // Put e to sleep or wake it, telling set(owner, asleep) to move it.
+    template <class Fn>
+    void change(entry& e, bool asleep, reason why, Fn set) {
+        if (!asleep) {
+            cancel_timer(e);
+        }
+        if (e.asleep == asleep) {
+            return;
+        }
+        e.asleep = asleep;
+        if (asleep) {
+            e.asleep_slot = (int)sleeping.size();
+            sleeping.push_back(&e);
+        } else {
+            erase(sleeping, e.asleep_slot, &entry::asleep_slot);
+            ++counts.woken[why];
+        }
+        set(e.owner, asleep);
+    }
+
+public:
+    sleep_schedule() : now(0.0), counts{ 0, 0, { 0, 0, 0 } } { }
+
+    sleep_schedule(const sleep_schedule&) = delete;
+    sleep_schedule& operator=(const sleep_schedule&) = delete;
+
+    void add(entry&) {
+        ++counts.nodes;
+    }
+
+    // Take e out of every list, as its node goes away.
+    void remove(entry& e) {
+        std::lock_guard<std::mutex> lock(request_mutex);
+        if (e.pending_slot >= 0) {
+            erase(pending, e.pending_slot, &entry::pending_slot);
+        }
+        cancel_timer(e);
+        if (e.asleep_slot >= 0) {
+            erase(sleeping, e.asleep_slot, &entry::asleep_slot);
+        }
+        --counts.nodes;
+    }
+
+    // Asleep from the next apply() until woken.
+    void sleep(entry& e) {
+        std::lock_guard<std::mutex> lock(request_mutex);
+        request(e, true, event);
+        e.requested_wake = -1.0;
+    }
+
+    // Asleep from the next apply() for seconds of the time given to apply(),
+    // unless woken before.
+    void sleep_for(entry& e, float seconds) {
+        std::lock_guard<std::mutex> lock(request_mutex);
+        request(e, true, event);
+        e.requested_wake = now + seconds;
+    }
+
+    void wake(entry& e, reason why) {
+        std::lock_guard<std::mutex> lock(request_mutex);
+        request(e, false, why);
+    }
+
+    // Move the clock on by dt, then wake the nodes whose timers are due and
+    // carry out the requests made since the last call. set(node*, asleep) moves
+    // each node that changes. Nothing may be updating the nodes meanwhile.
+    template <class Fn>
+    void apply(float dt, Fn set) {
+        std::lock_guard<std::mutex> lock(request_mutex);
+        now += dt;
+        while (!timers.empty() && timers[0]->wake_time <= now) {
+            change(*timers[0], false, timer, set);
+        }
+
+        for (entry* e : pending) {
+            e->pending_slot = -1;
+            change(*e, e->requested, e->why, set);
+            if (e->requested) {
+                cancel_timer(*e);
+                if (e->requested_wake >= 0.0) {
+                    e->wake_time = e->requested_wake;
+                    e->timer_slot = (int)timers.size();
+                    timers.push_back(e);
+                    sift_up(e->timer_slot);
+                }
+            }
+        }
+        pending.clear();
+        counts.asleep = (int)sleeping.size();
+    }
+
+    // The time so far, as given to apply().
+    double time() const {
+        return now;
+    }
+
+    const std::vector<entry*>& asleep() const {
+        return sleeping;
+    }
+
+    const stats& counters() const {
+        return counts;
+    }
+};
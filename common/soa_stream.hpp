@@ -0,0 +1,452 @@
+#pragma once
+#include <algorithm>
+#include <cstdint>
+#include <limits>
+#include <memory>
+#include <type_traits>
+#include <utility>
+#include <vector>
+#include "simd.hpp"
+#include "vector.hpp"
+#include "matrix.hpp"
+
+namespace soa_detail {
+
+    // The named components of an element, bound to element i of each component
+    // array (component c of element i is at p[c * stride]).
+    template <int N>
+    struct fields;
+
+    template <>
+    struct fields<2> {
+        float &x, &y;
+        fields(float* p, int stride) : x(p[0]), y(p[stride]) { }
+    };
+
+    template <>
+    struct fields<3> {
+        float &x, &y, &z;
+        fields(float* p, int stride) : x(p[0]), y(p[stride]), z(p[stride * 2]) { }
+    };
+
+    template <>
+    struct fields<4> {
+        float &x, &y, &z, &w;
+        fields(float* p, int stride) : x(p[0]), y(p[stride]), z(p[stride * 2]), w(p[stride * 3]) { }
+    };
+
+    // fn(0), fn(1), ..., fn(N - 1), written out so that per component registers
+    // indexed by c stay in registers; a loop over c would keep them in memory.
+    template <class Fn, size_t... I>
+    inline void unroll(Fn fn, std::index_sequence<I...>) {
+        int expand[] = { (fn(int(I)), 0)... };
+        (void)expand;
+    }
+
+    template <int N, class Fn>
+    inline void unroll(Fn fn) {
+        unroll(fn, std::make_index_sequence<N>());
+    }
+
+    // Capacity is kept a multiple of a cache line of floats, so every component
+    // array starts on a cache line.
+    const int block = 16;
+
+    // Whole registers of interleaved xyz or xyzw elements; vec2 goes through the scalar tail.
+    inline int interleave(float*, const float* const*, int, std::integral_constant<int, 2>) {
+        return 0;
+    }
+
+    inline int interleave(float* out, const float* const* c, int count, std::integral_constant<int, 3>) {
+        int i = 0;
+        for (; i + simd::lanes <= count; i += simd::lanes) {
+            simd::store_xyz(out + i * 3, simd::loadv(c[0] + i), simd::loadv(c[1] + i), simd::loadv(c[2] + i));
+        }
+        return i;
+    }
+
+    inline int interleave(float* out, const float* const* c, int count, std::integral_constant<int, 4>) {
+        int i = 0;
+        for (; i + simd::lanes <= count; i += simd::lanes) {
+            simd::store_xyzw(out + i * 4, simd::loadv(c[0] + i), simd::loadv(c[1] + i), simd::loadv(c[2] + i), simd::loadv(c[3] + i));
+        }
+        return i;
+    }
+
+    inline int deinterleave(const float*, float* const*, int, std::integral_constant<int, 2>) {
+        return 0;
+    }
+
+    inline int deinterleave(const float* in, float* const* c, int count, std::integral_constant<int, 3>) {
+        int i = 0;
+        for (; i + simd::lanes <= count; i += simd::lanes) {
+            simd::floatv x, y, z;
+            simd::load_xyz(in + i * 3, x, y, z);
+            simd::storev(c[0] + i, x);
+            simd::storev(c[1] + i, y);
+            simd::storev(c[2] + i, z);
+        }
+        return i;
+    }
+
+    inline int deinterleave(const float* in, float* const* c, int count, std::integral_constant<int, 4>) {
+        int i = 0;
+        for (; i + simd::lanes <= count; i += simd::lanes) {
+            simd::floatv x, y, z, w;
+            simd::load_xyzw(in + i * 4, x, y, z, w);
+            simd::storev(c[0] + i, x);
+            simd::storev(c[1] + i, y);
+            simd::storev(c[2] + i, z);
+            simd::storev(c[3] + i, w);
+        }
+        return i;
+    }
+}
+
+
+// A growable array of float vectors stored as one array per component (all the
+// x, then all the y, ...), for per-entity data that is processed in bulk:
+// particles, velocities, orbital states. Bulk operations load simd::lanes
+// elements per component register instead of shuffling 12 byte structs apart.
+// Single elements are read and written through a proxy that behaves like the
+// vector:
+//
+//     soa_stream<vec3> velocity(count);
+//     velocity[i] = vec3{ 0.0f, 1.0f, 0.0f };
+//     velocity[i].y -= 9.81f * dt;
+//     vec3 v = velocity[i];
+//
+// (auto v = velocity[i] gives the proxy, not a copy.) The operations below and
+// the stream3 transforms in matrix.hpp work on whole streams, and interleaved()
+// converts to the vertex layout gl::buffer::set_data takes.
+template <class V>
+class soa_stream {
+public:
+    static const int N = sizeof(V) / sizeof(float);
+    static_assert(std::is_same<V, vector<float, N>>::value, "soa_stream holds float vectors");
+
+    class reference : public soa_detail::fields<N> {
+        float* p;
+        int stride;
+
+        reference(float* p, int stride) : soa_detail::fields<N>(p, stride), p(p), stride(stride) { }
+        friend class soa_stream;
+
+    public:
+        reference(const reference&) = default;
+
+        float& operator[](int c) const {
+            return p[c * stride];
+        }
+
+        operator V() const {
+            V v;
+            for (int c = 0; c < N; ++c) {
+                v.data[c] = p[c * stride];
+            }
+            return v;
+        }
+
+        const reference& operator=(const V& v) const {
+            for (int c = 0; c < N; ++c) {
+                p[c * stride] = v.data[c];
+            }
+            return *this;
+        }
+
+        const reference& operator=(const reference& r) const {
+            return *this = V(r);
+        }
+
+        const reference& operator+=(const V& v) const { return *this = V(*this) + v; }
+        const reference& operator-=(const V& v) const { return *this = V(*this) - v; }
+        const reference& operator*=(float s) const { return *this = V(*this) * s; }
+    };
+
+
+    soa_stream() : data(nullptr), count(0), reserved(0) { }
+
+    explicit soa_stream(int count, const V& value = V()) : soa_stream() {
+        resize(count, value);
+    }
+
+    // From an interleaved array, e.g. mesh vertices.
+    soa_stream(const V* elements, int count) : soa_stream() {
+        assign(elements, count);
+    }
+
+    soa_stream(const soa_stream& other) : soa_stream() {
+        *this = other;
+    }
+
+    soa_stream(soa_stream&& move) : soa_stream() {
+        swap(move);
+    }
+
+    soa_stream& operator=(const soa_stream& other) {
+        if (this != &other) {
+            clear();
+            reserve(other.count);
+            for (int c = 0; c < N; ++c) {
+                std::copy(other.component(c), other.component(c) + other.count, component(c));
+            }
+            count = other.count;
+        }
+        return *this;
+    }
+
+    soa_stream& operator=(soa_stream&& move) {
+        swap(move);
+        return *this;
+    }
+
+    void swap(soa_stream& other) {
+        std::swap(buffer, other.buffer);
+        std::swap(data, other.data);
+        std::swap(count, other.count);
+        std::swap(reserved, other.reserved);
+    }
+
+
+    int size() const { return count; }
+    bool empty() const { return count == 0; }
+    int capacity() const { return reserved; }
+
+    void reserve(int n) {
+        if (n <= reserved) {
+            return;
+        }
+        int grown = (std::max(n, reserved * 2) + soa_detail::block - 1) / soa_detail::block * soa_detail::block;
+
+        // One allocation holds every component array, aligned to a cache line.
+        std::unique_ptr<float[]> b(new float[size_t(grown) * N + soa_detail::block]);
+        float* d = reinterpret_cast<float*>((reinterpret_cast<uintptr_t>(b.get()) + 63) & ~uintptr_t(63));
+        for (int c = 0; c < N; ++c) {
+            std::copy(component(c), component(c) + count, d + size_t(c) * grown);
+        }
+        buffer = std::move(b);
+        data = d;
+        reserved = grown;
+    }
+
+    void resize(int n, const V& value = V()) {
+        reserve(n);
+        for (int c = 0; c < N; ++c) {
+            std::fill(component(c) + count, component(c) + std::max(n, count), value.data[c]);
+        }
+        count = n;
+    }
+
+    void clear() {
+        count = 0;
+    }
+
+    void push_back(const V& v) {
+        reserve(count + 1);
+        ++count;
+        (*this)[count - 1] = v;
+    }
+
+    void pop_back() {
+        --count;
+    }
+
+    // Remove element i in O(1) by moving the last element into its place.
+    void swap_remove(int i) {
+        (*this)[i] = (*this)[count - 1];
+        --count;
+    }
+
+
+    reference operator[](int i) {
+        return reference(data + i, reserved);
+    }
+
+    V operator[](int i) const {
+        V v;
+        for (int c = 0; c < N; ++c) {
+            v.data[c] = component(c)[i];
+        }
+        return v;
+    }
+
+    // The contiguous array of component c, size() floats long.
+    float* component(int c) {
+        return data + size_t(c) * reserved;
+    }
+
+    const float* component(int c) const {
+        return data + size_t(c) * reserved;
+    }
+
+    float* x() { return component(0); }
+    float* y() { return component(1); }
+    const float* x() const { return component(0); }
+    const float* y() const { return component(1); }
+
+    template <int M = N, class = typename std::enable_if<(M >= 3)>::type>
+    float* z() { return component(2); }
+    template <int M = N, class = typename std::enable_if<(M >= 3)>::type>
+    const float* z() const { return component(2); }
+
+    template <int M = N, class = typename std::enable_if<(M >= 4)>::type>
+    float* w() { return component(3); }
+    template <int M = N, class = typename std::enable_if<(M >= 4)>::type>
+    const float* w() const { return component(3); }
+
+    // The x, y and z arrays, for transform_points and friends.
+    template <int M = N, class = typename std::enable_if<(M >= 3)>::type>
+    stream3<float> streams() {
+        return stream3<float>{ component(0), component(1), component(2) };
+    }
+
+    template <int M = N, class = typename std::enable_if<(M >= 3)>::type>
+    stream3<const float> streams() const {
+        return stream3<const float>{ component(0), component(1), component(2) };
+    }
+
+
+    // Replace the contents with count interleaved elements.
+    void assign(const V* elements, int n) {
+        clear();
+        reserve(n);
+        float* c[N];
+        for (int j = 0; j < N; ++j) {
+            c[j] = component(j);
+        }
+        const float* in = elements->data.data();
+        int i = soa_detail::deinterleave(in, c, n, std::integral_constant<int, N>());
+        for (; i < n; ++i) {
+            for (int j = 0; j < N; ++j) {
+                c[j][i] = in[i * N + j];
+            }
+        }
+        count = n;
+    }
+
+    // Write every element, interleaved, to out.
+    void interleave(V* out) const {
+        const float* c[N];
+        for (int j = 0; j < N; ++j) {
+            c[j] = component(j);
+        }
+        float* o = out->data.data();
+        int i = soa_detail::interleave(o, c, count, std::integral_constant<int, N>());
+        for (; i < count; ++i) {
+            for (int j = 0; j < N; ++j) {
+                o[i * N + j] = c[j][i];
+            }
+        }
+    }
+
+    // The elements as an array of vectors, ready for gl::buffer::set_data.
+    std::vector<V> interleaved() const {
+        std::vector<V> out(count);
+        if (count) {
+            interleave(out.data());
+        }
+        return out;
+    }
+
+private:
+    std::unique_ptr<float[]> buffer;
+    float* data;
+    int count, reserved;
+};
+
+
+// Bulk operations, simd::lanes elements per iteration. Streams passed together
+// must be the same size; out may be one of the inputs.
+
+// y[i] += a * x[i]
+template <class V>
+void axpy(float a, const soa_stream<V>& x, soa_stream<V>& y) {
+    simd::floatv av = simd::setv(a);
+    for (int c = 0; c < soa_stream<V>::N; ++c) {
+        const float* in = x.component(c);
+        float* out = y.component(c);
+        int i = 0;
+        for (; i + simd::lanes <= y.size(); i += simd::lanes) {
+            simd::storev(out + i, simd::loadv(out + i) + av * simd::loadv(in + i));
+        }
+        for (; i < y.size(); ++i) {
+            out[i] += a * in[i];
+        }
+    }
+}
+
+// Scale every element to unit length. Zero length elements become NaN, as with vector::normalize.
+template <class V>
+void normalize_all(soa_stream<V>& s) {
+    const int N = soa_stream<V>::N;
+    float* c[N];
+    for (int j = 0; j < N; ++j) {
+        c[j] = s.component(j);
+    }
+    int i = 0;
+    for (; i + simd::lanes <= s.size(); i += simd::lanes) {
+        simd::floatv v[N], l = simd::setv(0.0f);
+        soa_detail::unroll<N>([&](int j) {
+            v[j] = simd::loadv(c[j] + i);
+            l = l + v[j] * v[j];
+        });
+        l = simd::sqrt(l);
+        soa_detail::unroll<N>([&](int j) { simd::storev(c[j] + i, v[j] / l); });
+    }
+    for (; i < s.size(); ++i) {
+        s[i] = V(s[i]).normalized();
+    }
+}
+
+// out[i] = a[i].dot(b[i])
+template <class V>
+void dot_all(const soa_stream<V>& a, const soa_stream<V>& b, float* out) {
+    const int N = soa_stream<V>::N;
+    int i = 0;
+    for (; i + simd::lanes <= a.size(); i += simd::lanes) {
+        simd::floatv d = simd::setv(0.0f);
+        soa_detail::unroll<N>([&](int j) { d = d + simd::loadv(a.component(j) + i) * simd::loadv(b.component(j) + i); });
+        simd::storev(out + i, d);
+    }
+    for (; i < a.size(); ++i) {
+        out[i] = a[i].dot(b[i]);
+    }
+}
+
+// The componentwise minimum and maximum over every element; +inf and -inf when empty.
+// One pass reads every component array side by side.
+template <class V>
+void min_max(const soa_stream<V>& s, V& lo, V& hi) {
+    const int N = soa_stream<V>::N;
+    const float inf = std::numeric_limits<float>::infinity();
+    simd::floatv vlo[N], vhi[N];
+    for (int c = 0; c < N; ++c) {
+        vlo[c] = simd::setv(inf);
+        vhi[c] = simd::setv(-inf);
+    }
+    int i = 0;
+    for (; i + simd::lanes <= s.size(); i += simd::lanes) {
+        soa_detail::unroll<N>([&](int c) {
+            simd::floatv v = simd::loadv(s.component(c) + i);
+            vlo[c] = simd::min(vlo[c], v);
+            vhi[c] = simd::max(vhi[c], v);
+        });
+    }
+
+    for (int c = 0; c < N; ++c) {
+        float l[simd::lanes], h[simd::lanes];
+        simd::storev(l, vlo[c]);
+        simd::storev(h, vhi[c]);
+        float rl = inf, rh = -inf;
+        for (int j = 0; j < simd::lanes; ++j) {
+            rl = std::min(rl, l[j]);
+            rh = std::max(rh, h[j]);
+        }
+        for (int j = i; j < s.size(); ++j) {
+            rl = std::min(rl, s.component(c)[j]);
+            rh = std::max(rh, s.component(c)[j]);
+        }
+        lo.data[c] = rl;
+        hi.data[c] = rh;
+    }
+}
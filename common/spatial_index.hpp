@@ -0,0 +1,596 @@
+#pragma once
+#include <vector>
+#include <queue>
+#include <utility>
+#include <algorithm>
+#include <functional>
+#include <limits>
+#include <cassert>
+#include "maths.hpp"
+#include "job_system.hpp"
+
+// A dynamic bounding volume hierarchy over boxes, each carrying a value of type
+// T. Objects are named by proxy ids that stay valid until they are removed.
+//
+// The tree stores every box grown by margin, so an object can move around
+// inside its fattened box without touching the tree; only when it leaves does
+// move() take its leaf out and insert it again. Inserts descend to the sibling
+// that grows the tree's surface area least, and removals and inserts rebalance
+// on the way back up with tree rotations, so the tree stays O(log n) deep while
+// objects come and go. rebuild() builds a fresh tree top down from every live
+// object, splitting subtrees across a job system if given one.
+//
+// Queries test the fattened boxes on the way down and each object's own box at
+// the leaves, so their results are exact for the boxes given. Queries may run
+// concurrently with each other, but not with changes.
+template <class T>
+class spatial_index {
+    struct tree_node {
+        aabb box;       // fattened for leaves
+        int parent;     // next free node while free
+        int children[2]; // -1 for leaves
+        int height;     // 0 for leaves
+        int proxy;      // leaves only
+    };
+
+    struct proxy_entry {
+        aabb box;
+        int leaf; // -1 while free
+        T value;
+    };
+
+    static const int max_depth = 256;
+
+    std::vector<tree_node> nodes;
+    std::vector<proxy_entry> proxies;
+    std::vector<int> free_proxies;
+    int root;
+    int free_nodes;
+    int live;
+    float margin;
+
+    static float area(const aabb& b) {
+        vec3 d = b.max - b.min;
+        return 2.0f * (d.x * d.y + d.y * d.z + d.z * d.x);
+    }
+
+    static aabb merged(const aabb& a, const aabb& b) {
+        return aabb{ vec3{ std::min(a.min.x, b.min.x), std::min(a.min.y, b.min.y), std::min(a.min.z, b.min.z) },
+                     vec3{ std::max(a.max.x, b.max.x), std::max(a.max.y, b.max.y), std::max(a.max.z, b.max.z) } };
+    }
+
+    static bool encloses(const aabb& outer, const aabb& inner) {
+        return outer.min.x <= inner.min.x && outer.min.y <= inner.min.y && outer.min.z <= inner.min.z &&
+               outer.max.x >= inner.max.x && outer.max.y >= inner.max.y && outer.max.z >= inner.max.z;
+    }
+
+    static float distance_squared(const aabb& b, const vec3& p) {
+        float dx = std::max(0.0f, std::max(b.min.x - p.x, p.x - b.max.x));
+        float dy = std::max(0.0f, std::max(b.min.y - p.y, p.y - b.max.y));
+        float dz = std::max(0.0f, std::max(b.min.z - p.z, p.z - b.max.z));
+        return dx * dx + dy * dy + dz * dz;
+    }
+
+    // Slab test with the direction already inverted; the entry distance or -1.
+    static float enter(const aabb& b, const vec3& origin, const vec3& inv, float max_distance) {
+        float t0 = 0.0f, t1 = max_distance;
+        for (int i = 0; i < 3; ++i) {
+            float a = (b.min.data[i] - origin.data[i]) * inv.data[i];
+            float c = (b.max.data[i] - origin.data[i]) * inv.data[i];
+            t0 = std::max(t0, std::min(a, c));
+            t1 = std::min(t1, std::max(a, c));
+        }
+        return t0 <= t1 ? t0 : -1.0f;
+    }
+
+    aabb fattened(const aabb& b) const {
+        return aabb{ b.min - vec3(margin), b.max + vec3(margin) };
+    }
+
+    bool leaf(int i) const {
+        return nodes[i].children[0] < 0;
+    }
+
+    int allocate() {
+        if (free_nodes < 0) {
+            nodes.push_back(tree_node());
+            return (int)nodes.size() - 1;
+        }
+        int i = free_nodes;
+        free_nodes = nodes[i].parent;
+        return i;
+    }
+
+    void release(int i) {
+        nodes[i].parent = free_nodes;
+        nodes[i].height = -1;
+        free_nodes = i;
+    }
+
+    void refit(int i) {
+        tree_node& n = nodes[i];
+        n.box = merged(nodes[n.children[0]].box, nodes[n.children[1]].box);
+        n.height = 1 + std::max(nodes[n.children[0]].height, nodes[n.children[1]].height);
+    }
+
+    void replace_child(int parent, int from, int to) {
+        if (parent < 0) {
+            root = to;
+        } else {
+            tree_node& p = nodes[parent];
+            p.children[p.children[0] == from ? 0 : 1] = to;
+        }
+    }
+
+    // If one child of a is two or more levels taller than the other, rotate the
+    // taller one up in a's place. Returns the node now in a's place.
+    int balance(int a) {
+        if (leaf(a) || nodes[a].height < 2) {
+            return a;
+        }
+        int b = nodes[a].children[0], c = nodes[a].children[1];
+        int diff = nodes[c].height - nodes[b].height;
+        if (diff > -2 && diff < 2) {
+            return a;
+        }
+
+        // up is the taller child, and it swaps places with a; a keeps other and
+        // the shorter of up's children.
+        int side = diff > 1 ? 1 : 0;
+        int up = nodes[a].children[side];
+        int f = nodes[up].children[0], g = nodes[up].children[1];
+        nodes[up].children[0] = a;
+        nodes[up].parent = nodes[a].parent;
+        nodes[a].parent = up;
+        replace_child(nodes[up].parent, a, up);
+
+        int keep = nodes[f].height > nodes[g].height ? f : g;
+        int give = keep == f ? g : f;
+        nodes[up].children[1] = keep;
+        nodes[a].children[side] = give;
+        nodes[give].parent = a;
+        refit(a);
+        balance(a); // a can be left lopsided by what it was given
+        refit(up);
+        return up;
+    }
+
+    void insert_leaf(int leaf_node) {
+        if (root < 0) {
+            root = leaf_node;
+            nodes[root].parent = -1;
+            return;
+        }
+
+        // Walk down to the sibling that costs least, by surface area.
+        aabb box = nodes[leaf_node].box;
+        int i = root;
+        while (!leaf(i)) {
+            const tree_node& n = nodes[i];
+            float combined = area(merged(n.box, box));
+            float cost = 2.0f * combined;
+            float inherited = 2.0f * (combined - area(n.box));
+            float child_cost[2];
+            for (int k = 0; k < 2; ++k) {
+                const tree_node& c = nodes[n.children[k]];
+                float grown = area(merged(c.box, box));
+                child_cost[k] = (c.children[0] < 0 ? grown : grown - area(c.box)) + inherited;
+            }
+            if (cost < child_cost[0] && cost < child_cost[1]) {
+                break;
+            }
+            i = n.children[child_cost[0] < child_cost[1] ? 0 : 1];
+        }
+
+        int sibling = i, old_parent = nodes[sibling].parent;
+        int p = allocate();
+        nodes[p].parent = old_parent;
+        nodes[p].children[0] = sibling;
+        nodes[p].children[1] = leaf_node;
+        nodes[p].proxy = -1;
+        nodes[sibling].parent = p;
+        nodes[leaf_node].parent = p;
+        replace_child(old_parent, sibling, p);
+        refit(p); // p's height, so balance() sees it is unbalanced when sibling is tall
+
+        for (i = p; i >= 0; i = nodes[i].parent) {
+            i = balance(i);
+            refit(i);
+        }
+    }
+
+    void remove_leaf(int leaf_node) {
+        if (leaf_node == root) {
+            root = -1;
+            return;
+        }
+        int p = nodes[leaf_node].parent, grandparent = nodes[p].parent;
+        int sibling = nodes[p].children[nodes[p].children[0] == leaf_node ? 1 : 0];
+        replace_child(grandparent, p, sibling);
+        nodes[sibling].parent = grandparent;
+        release(p);
+
+        for (int i = grandparent; i >= 0; i = nodes[i].parent) {
+            i = balance(i);
+            refit(i);
+        }
+    }
+
+    struct build_item {
+        vec3 center;
+        int proxy;
+    };
+
+    // Builds the subtree for items[begin, end) into the 2n - 1 nodes from base:
+    // the root at base, then the left subtree, then the right.
+    void build(build_item* items, int begin, int end, int base, int parent, job_system* jobs) {
+        tree_node& n = nodes[base];
+        n.parent = parent;
+        if (end - begin == 1) {
+            proxy_entry& p = proxies[items[begin].proxy];
+            n.box = fattened(p.box);
+            n.children[0] = n.children[1] = -1;
+            n.height = 0;
+            n.proxy = items[begin].proxy;
+            p.leaf = base;
+            return;
+        }
+
+        // Split across the middle of the axis the centers spread most, or at the
+        // median if everything lands on one side.
+        aabb spread = aabb::empty();
+        for (int i = begin; i < end; ++i) {
+            spread.merge(items[i].center);
+        }
+        vec3 s = spread.max - spread.min;
+        int axis = s.x > s.y ? (s.x > s.z ? 0 : 2) : (s.y > s.z ? 1 : 2);
+        float split = (spread.min.data[axis] + spread.max.data[axis]) * 0.5f;
+        int mid = int(std::partition(items + begin, items + end, [axis, split](const build_item& a) {
+            return a.center.data[axis] < split;
+        }) - items);
+        if (mid == begin || mid == end) {
+            mid = begin + (end - begin) / 2;
+            std::nth_element(items + begin, items + mid, items + end, [axis](const build_item& a, const build_item& b) {
+                return a.center.data[axis] < b.center.data[axis];
+            });
+        }
+
+        int left = base + 1, right = base + 2 * (mid - begin);
+        if (jobs && end - begin > 4096) {
+            job_counter done;
+            jobs->run([=] { build(items, begin, mid, left, base, jobs); }, &done);
+            build(items, mid, end, right, base, jobs);
+            jobs->wait(done);
+        } else {
+            build(items, begin, mid, left, base, nullptr);
+            build(items, mid, end, right, base, nullptr);
+        }
+        n.children[0] = left;
+        n.children[1] = right;
+        n.proxy = -1;
+        refit(base);
+    }
+
+public:
+    // Boxes are grown by margin in the tree: objects that move less than that
+    // between calls to move() cost nothing.
+    explicit spatial_index(float margin = 0.1f) : root(-1), free_nodes(-1), live(0), margin(margin) { }
+
+    int size() const {
+        return live;
+    }
+
+    // Levels in the tree, 0 when empty.
+    int height() const {
+        return root < 0 ? 0 : nodes[root].height + 1;
+    }
+
+    // Add an object with bounds box. Returns its proxy id.
+    int insert(const aabb& box, const T& value) {
+        int id;
+        if (free_proxies.empty()) {
+            id = (int)proxies.size();
+            proxies.push_back(proxy_entry());
+        } else {
+            id = free_proxies.back();
+            free_proxies.pop_back();
+        }
+
+        int l = allocate();
+        nodes[l].box = fattened(box);
+        nodes[l].children[0] = nodes[l].children[1] = -1;
+        nodes[l].height = 0;
+        nodes[l].proxy = id;
+        proxies[id] = proxy_entry{ box, l, value };
+        insert_leaf(l);
+        ++live;
+        return id;
+    }
+
+    void remove(int id) {
+        int l = proxies[id].leaf;
+        remove_leaf(l);
+        release(l);
+        proxies[id].leaf = -1;
+        free_proxies.push_back(id);
+        --live;
+    }
+
+    // Give id new bounds. Returns whether the tree had to change.
+    bool move(int id, const aabb& box) {
+        proxy_entry& p = proxies[id];
+        p.box = box;
+        if (encloses(nodes[p.leaf].box, box)) {
+            return false;
+        }
+        remove_leaf(p.leaf);
+        nodes[p.leaf].box = fattened(box);
+        insert_leaf(p.leaf);
+        return true;
+    }
+
+    const aabb& bounds(int id) const {
+        return proxies[id].box;
+    }
+
+    T& value(int id) {
+        return proxies[id].value;
+    }
+
+    // fn(id, value) for every object.
+    template <class Fn>
+    void each(Fn fn) {
+        for (size_t i = 0; i < proxies.size(); ++i) {
+            if (proxies[i].leaf >= 0) {
+                fn((int)i, proxies[i].value);
+            }
+        }
+    }
+
+    // Throw the tree away and build a fresh one top down, which beats the
+    // incremental tree for queries once much has moved. Subtrees are split at
+    // the middle of their centers' spread, so the tree follows how the objects
+    // cluster rather than being balanced by count: 200k random boxes come out
+    // 23 levels deep, where a median split would give 19. jobs, if given,
+    // builds large subtrees in parallel.
+    void rebuild(job_system* jobs = nullptr) {
+        std::vector<build_item> items;
+        items.reserve(live);
+        for (size_t i = 0; i < proxies.size(); ++i) {
+            if (proxies[i].leaf >= 0) {
+                items.push_back(build_item{ proxies[i].box.center(), (int)i });
+            }
+        }
+        nodes.clear();
+        free_nodes = -1;
+        root = -1;
+        if (items.empty()) {
+            return;
+        }
+        nodes.resize(2 * items.size() - 1);
+        build(items.data(), 0, (int)items.size(), 0, -1, jobs);
+        root = 0;
+    }
+
+    // fn(value) for every object whose box intersects b.
+    template <class Fn>
+    void query(const aabb& b, Fn fn) const {
+        if (root < 0) {
+            return;
+        }
+        int stack[max_depth], top = 0;
+        stack[top++] = root;
+        while (top) {
+            const tree_node& n = nodes[stack[--top]];
+            if (!n.box.intersects(b)) {
+                continue;
+            }
+            if (n.children[0] < 0) {
+                if (proxies[n.proxy].box.intersects(b)) {
+                    fn(proxies[n.proxy].value);
+                }
+            } else {
+                assert(top + 2 <= max_depth);
+                stack[top++] = n.children[1];
+                stack[top++] = n.children[0];
+            }
+        }
+    }
+
+    // fn(value) for every object whose box intersects s.
+    template <class Fn>
+    void query(const sphere& s, Fn fn) const {
+        if (root < 0) {
+            return;
+        }
+        int stack[max_depth], top = 0;
+        stack[top++] = root;
+        while (top) {
+            const tree_node& n = nodes[stack[--top]];
+            if (!n.box.intersects(s)) {
+                continue;
+            }
+            if (n.children[0] < 0) {
+                if (proxies[n.proxy].box.intersects(s)) {
+                    fn(proxies[n.proxy].value);
+                }
+            } else {
+                assert(top + 2 <= max_depth);
+                stack[top++] = n.children[1];
+                stack[top++] = n.children[0];
+            }
+        }
+    }
+
+    // fn(value) for every object whose box may be inside f, as frustum::intersects.
+    // Planes a subtree is wholly in front of are not tested again below it, and
+    // subtrees wholly inside are taken without further tests.
+    template <class Fn>
+    void query(const frustum& f, Fn fn) const {
+        if (root < 0) {
+            return;
+        }
+        int stack[max_depth], masks[max_depth], top = 0;
+        stack[top] = root;
+        masks[top++] = 63;
+        while (top) {
+            --top;
+            const tree_node& n = nodes[stack[top]];
+            int mask = masks[top];
+            bool leaf_node = n.children[0] < 0;
+            const aabb& box = leaf_node ? proxies[n.proxy].box : n.box;
+
+            vec3 c = box.center(), e = box.extents();
+            bool outside = false;
+            for (int i = 0; i < 6 && !outside; ++i) {
+                if (mask >> i & 1) {
+                    const plane& pl = f.planes[i];
+                    float r = std::fabs(pl.normal.x) * e.x + std::fabs(pl.normal.y) * e.y + std::fabs(pl.normal.z) * e.z;
+                    float d = pl.distance(c);
+                    outside = d < -r;
+                    if (d >= r) {
+                        mask &= ~(1 << i);
+                    }
+                }
+            }
+            if (outside) {
+                continue;
+            }
+
+            if (leaf_node) {
+                fn(proxies[n.proxy].value);
+            } else if (mask == 0) {
+                each_leaf(stack[top], fn);
+            } else {
+                assert(top + 2 <= max_depth);
+                stack[top] = n.children[1];
+                masks[top++] = mask;
+                stack[top] = n.children[0];
+                masks[top++] = mask;
+            }
+        }
+    }
+
+    // fn(value) for every object under tree node i, untested.
+    template <class Fn>
+    void each_leaf(int i, Fn fn) const {
+        int stack[max_depth], top = 0;
+        stack[top++] = i;
+        while (top) {
+            const tree_node& n = nodes[stack[--top]];
+            if (n.children[0] < 0) {
+                fn(proxies[n.proxy].value);
+            } else {
+                assert(top + 2 <= max_depth);
+                stack[top++] = n.children[1];
+                stack[top++] = n.children[0];
+            }
+        }
+    }
+
+    // fn(value, t) for the objects whose boxes r enters at t before max_distance,
+    // nearer subtrees first. fn returns the distance to search up to from then
+    // on: t to keep only nearer hits, max_distance to carry on as before, or 0
+    // (or less) to stop; fn is not called again after that.
+    template <class Fn>
+    void raycast(const ray& r, float max_distance, Fn fn) const {
+        if (root < 0) {
+            return;
+        }
+        vec3 inv{ 1.0f / r.direction.x, 1.0f / r.direction.y, 1.0f / r.direction.z };
+        int stack[max_depth], top = 0;
+        float entry[max_depth];
+        stack[top] = root;
+        entry[top++] = 0.0f;
+        while (top) {
+            --top;
+            if (entry[top] > max_distance) {
+                continue;
+            }
+            const tree_node& n = nodes[stack[top]];
+            if (n.children[0] < 0) {
+                float t = enter(proxies[n.proxy].box, r.origin, inv, max_distance);
+                if (t >= 0.0f) {
+                    max_distance = fn(proxies[n.proxy].value, t);
+                    if (max_distance <= 0.0f) {
+                        return;
+                    }
+                }
+                continue;
+            }
+
+            float t[2];
+            for (int k = 0; k < 2; ++k) {
+                t[k] = enter(nodes[n.children[k]].box, r.origin, inv, max_distance);
+            }
+            int near_side = t[1] >= 0.0f && (t[0] < 0.0f || t[1] < t[0]) ? 1 : 0;
+            assert(top + 2 <= max_depth);
+            for (int k : { 1 - near_side, near_side }) {
+                if (t[k] >= 0.0f) {
+                    stack[top] = n.children[k];
+                    entry[top++] = t[k];
+                }
+            }
+        }
+    }
+
+    // The object whose box r enters first, if any before max_distance.
+    bool raycast(const ray& r, T& hit, float& t, float max_distance = std::numeric_limits<float>::infinity()) const {
+        bool found = false;
+        raycast(r, max_distance, [&](const T& value, float entered) {
+            hit = value;
+            t = entered;
+            found = true;
+            return entered;
+        });
+        return found;
+    }
+
+    // The up to k objects whose boxes are nearest p, nearest first, into out,
+    // with their squared distances into distances if given. Returns how many.
+    int nearest(const vec3& p, int k, T* out, float* distances = nullptr, float max_distance = std::numeric_limits<float>::infinity()) const {
+        if (root < 0 || k <= 0) {
+            return 0;
+        }
+        typedef std::pair<float, int> item; // squared distance, tree node or proxy
+        std::priority_queue<item, std::vector<item>, std::greater<item>> open;
+        std::priority_queue<item> best; // the k nearest so far, farthest on top
+        float limit = max_distance * max_distance;
+
+        open.push(item(distance_squared(nodes[root].box, p), root));
+        while (!open.empty() && open.top().first <= limit) {
+            int i = open.top().second;
+            open.pop();
+            const tree_node& n = nodes[i];
+            if (n.children[0] < 0) {
+                float d = distance_squared(proxies[n.proxy].box, p);
+                if (d <= limit) {
+                    best.push(item(d, n.proxy));
+                    if ((int)best.size() > k) {
+                        best.pop();
+                    }
+                    if ((int)best.size() == k) {
+                        limit = best.top().first;
+                    }
+                }
+            } else {
+                for (int c : n.children) {
+                    float d = distance_squared(nodes[c].box, p);
+                    if (d <= limit) {
+                        open.push(item(d, c));
+                    }
+                }
+            }
+        }
+
+        int count = (int)best.size();
+        for (int i = count - 1; i >= 0; --i) {
+            out[i] = proxies[best.top().second].value;
+            if (distances) {
+                distances[i] = best.top().first;
+            }
+            best.pop();
+        }
+        return count;
+    }
+};
@@ -0,0 +1,266 @@
+#pragma once
+#include <vector>
+#include <algorithm>
+#include <atomic>
+#include <cassert>
+#include "maths.hpp"
+
+// Local and world transforms of a whole scene graph in flat arrays, ordered so
+// that every parent comes before its children. World transforms are then one
+// linear pass, world[i] = world[parent[i]] * local[i], reading each array front
+// to back instead of chasing child pointers around the heap.
+//
+// Entries are named by a stable id that survives the reordering; the dense
+// position of an id changes whenever the order is rebuilt. Adding an entry keeps
+// the order (its parent already exists, so it comes earlier). Reparenting onto a
+// later entry and removing entries mark the order stale, and the next update()
+// rebuilds it in O(n) before computing the world transforms.
+//
+// World transforms are cached. set_local and set_parent mark an entry dirty, and
+// update() only recomputes dirty entries and their descendants; when nothing
+// moved it returns straight away, so static subtrees cost nothing per frame.
+// set_local may be called for different entries from several threads at once;
+// everything else, update() included, needs the hierarchy to itself.
+//
+// update() also keeps the world transforms it replaces, so a renderer running
+// between fixed simulation ticks can draw in between the last two.
+class transform_hierarchy {
+public:
+    struct stats {
+        int entries;
+        int recomputed; // world transforms recomputed by the last update()
+    };
+
+private:
+    // Dense arrays, parent before child. parents holds dense indices, -1 for roots.
+    std::vector<affine3> locals, worlds;
+    std::vector<affine3> previous; // worlds before the last update(), where changed
+    std::vector<int> parents;
+    std::vector<unsigned char> dirty;   // moved since the last update(); jumped as well
+    std::vector<unsigned char> changed; // world recomputed by the last update(); jumped as well
+    std::vector<int> changed_list;      // the ids of those
+
+    // With moved, an entry that was added or reparented: there is nothing to
+    // interpolate it from.
+    static const unsigned char jumped = 2;
+    std::vector<int> ids;       // dense index -> id, -1 once removed
+    std::vector<int> indices;   // id -> dense index, -1 when free
+    std::vector<int> free_ids;
+    int removed;
+    bool sorted;
+    std::atomic<bool> any_dirty;
+    stats last;
+
+    // Rebuild the dense arrays breadth first from the roots, dropping removed
+    // entries. Children of a removed entry become roots.
+    void sort() {
+        int n = (int)ids.size();
+
+        // Children grouped by parent, counting sort style; bucket 0 holds the roots.
+        std::vector<int> first(n + 2, 0), children(n);
+        for (int i = 0; i < n; ++i) {
+            if (ids[i] >= 0) {
+                int p = parents[i] >= 0 && ids[parents[i]] >= 0 ? parents[i] : -1;
+                if (p != parents[i]) {
+                    dirty[i] = 1 | jumped;
+                }
+                parents[i] = p;
+                ++first[p + 2];
+            }
+        }
+        for (int i = 1; i < n + 2; ++i) {
+            first[i] += first[i - 1];
+        }
+        for (int i = 0; i < n; ++i) {
+            if (ids[i] >= 0) {
+                children[first[parents[i] + 1]++] = i;
+            }
+        }
+        // first[p + 1] now ends p's children, first[p] starts them.
+
+        std::vector<int> order, moved(n, -1);
+        order.reserve(n - removed);
+        order.assign(children.begin(), children.begin() + first[0]);
+        for (size_t k = 0; k < order.size(); ++k) {
+            moved[order[k]] = (int)k;
+            int p = order[k];
+            order.insert(order.end(), children.begin() + first[p], children.begin() + first[p + 1]);
+        }
+        assert((int)order.size() == n - removed && "transform hierarchy has a cycle");
+
+        std::vector<affine3> l, w;
+        std::vector<int> pa, id;
+        std::vector<unsigned char> d;
+        l.reserve(order.size());
+        w.reserve(order.size());
+        pa.reserve(order.size());
+        id.reserve(order.size());
+        d.reserve(order.size());
+        for (int i : order) {
+            l.push_back(locals[i]);
+            w.push_back(worlds[i]);
+            pa.push_back(parents[i] >= 0 ? moved[parents[i]] : -1);
+            id.push_back(ids[i]);
+            d.push_back(dirty[i]);
+            indices[ids[i]] = (int)id.size() - 1;
+        }
+        locals.swap(l);
+        worlds.swap(w);
+        parents.swap(pa);
+        ids.swap(id);
+        dirty.swap(d);
+        changed.assign(ids.size(), 0);
+        removed = 0;
+        any_dirty.store(true, std::memory_order_relaxed);
+        sorted = true;
+    }
+
+public:
+    transform_hierarchy() : removed(0), sorted(true), any_dirty(false), last{ 0, 0 } { }
+
+    // A new entry under parent (an id, or -1 for a root). Returns its id.
+    int add(const affine3& local = affine3(), int parent = -1) {
+        int id;
+        if (free_ids.empty()) {
+            id = (int)indices.size();
+            indices.push_back(-1);
+        } else {
+            id = free_ids.back();
+            free_ids.pop_back();
+        }
+
+        indices[id] = (int)ids.size();
+        locals.push_back(local);
+        worlds.push_back(local);
+        parents.push_back(parent >= 0 ? indices[parent] : -1);
+        ids.push_back(id);
+        dirty.push_back(1 | jumped);
+        changed.push_back(0);
+        any_dirty.store(true, std::memory_order_relaxed);
+        return id;
+    }
+
+    // Release id. Its children become roots.
+    void remove(int id) {
+        int i = indices[id];
+        ids[i] = -1;
+        indices[id] = -1;
+        free_ids.push_back(id);
+        ++removed;
+        sorted = false;
+    }
+
+    // Move id under parent (an id, or -1 to make it a root).
+    void set_parent(int id, int parent) {
+        int i = indices[id];
+        int p = parent >= 0 ? indices[parent] : -1;
+        parents[i] = p;
+        dirty[i] = 1 | jumped;
+        any_dirty.store(true, std::memory_order_relaxed);
+        if (p > i) {
+            sorted = false;
+        }
+    }
+
+    int parent(int id) const {
+        int p = parents[indices[id]];
+        return p >= 0 ? ids[p] : -1;
+    }
+
+    const affine3& local(int id) const {
+        return locals[indices[id]];
+    }
+
+    void set_local(int id, const affine3& local) {
+        int i = indices[id];
+        locals[i] = local;
+        dirty[i] |= 1;
+        any_dirty.store(true, std::memory_order_relaxed);
+    }
+
+    // As of the last update().
+    const affine3& world(int id) const {
+        return worlds[indices[id]];
+    }
+
+    // Whether the last update() recomputed id's world transform.
+    bool changed_world(int id) const {
+        return changed[indices[id]] != 0;
+    }
+
+    // The ids whose world transforms the last update() recomputed, parents
+    // before children.
+    const std::vector<int>& changed_ids() const {
+        return changed_list;
+    }
+
+    // alpha of the way from id's world transform before the last update() to
+    // the one after. Entries that were added or reparented by it have no before
+    // and give world(id). The elements are blended linearly, which is close
+    // enough to the true in-between for the small turns of one tick.
+    affine3 interpolated_world(int id, float alpha) const {
+        int i = indices[id];
+        if (changed[i] != 1) {
+            return worlds[i];
+        }
+        affine3 w(uninitialized);
+        for (int k = 0; k < 12; ++k) {
+            w.data[k] = lerp(previous[i].data[k], worlds[i].data[k], alpha);
+        }
+        return w;
+    }
+
+    const stats& last_update() const {
+        return last;
+    }
+
+    // Live entries.
+    int size() const {
+        return (int)ids.size() - removed;
+    }
+
+    // Bring the order up to date if needed and recompute the world transforms of
+    // every dirty entry and its descendants.
+    const stats& update() {
+        if (!sorted) {
+            sort();
+        }
+
+        int n = (int)locals.size();
+        if (!any_dirty.load(std::memory_order_relaxed)) {
+            if (last.recomputed) {
+                std::fill(changed.begin(), changed.end(), 0);
+                changed_list.clear();
+            }
+            last = stats{ n, 0 };
+            return last;
+        }
+
+        previous.resize(n);
+        const int* p = parents.data();
+        const affine3* l = locals.data();
+        affine3* w = worlds.data();
+        affine3* before = previous.data();
+        unsigned char* d = dirty.data();
+        unsigned char* c = changed.data();
+        changed_list.clear();
+        for (int i = 0; i < n; ++i) {
+            c[i] = d[i] | (p[i] >= 0 ? c[p[i]] : 0);
+            if (c[i]) {
+                before[i] = w[i];
+                w[i] = p[i] >= 0 ? w[p[i]] * l[i] : l[i];
+                changed_list.push_back(ids[i]);
+            }
+        }
+        int recomputed = (int)changed_list.size();
+
+        std::fill(dirty.begin(), dirty.end(), 0);
+        any_dirty.store(false, std::memory_order_relaxed);
+        last = stats{ n, recomputed };
+        return last;
+    }
+
+    // The dense arrays, parent before child, valid until the order next changes.
+    const affine3* world_data() const { return worlds.data(); }
+    const int* parent_data() const { return parents.data(); }
+};
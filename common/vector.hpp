@@ -1,30 +1,16 @@
 #pragma once
 #include "vector_base.hpp"
 #include <cmath>
+#include <type_traits>
 
 
 template <class T, int N>
 class vector : public Vector_data<T, N> {
 public:
 
-    vector(T x = 0) {
-        for (int i = 0; i < N; ++i) {
-            this->data[i] = x;
-        }
-    }
+    constexpr vector(T x = 0) : Vector_data<T, N>(vector_detail::fill(x, std::make_index_sequence<N>())) { }
 
-    vector(std::initializer_list<T> elements) {
-        int i = 0;
-        for (const T& e : elements) {
-            this->data[i++] = e;
-        }
-    }
-
-    vector(const vector& v) {
-        for (int i = 0; i < N; ++i) {
-            this->data[i] = v.data[i];
-        }
-    }
+    constexpr vector(std::initializer_list<T> elements) : Vector_data<T, N>(vector_detail::from_list(elements, std::make_index_sequence<N>())) { }
 
 
     T dot(const vector& v) const {
@@ -89,13 +75,6 @@ public:
     }
 
 
-    vector& operator=(const vector& v) {
-        for (int i = 0; i < N; ++i) {
-            this->data[i] = v.data[i];
-        }
-        return *this;
-    }
-
     vector& operator+=(const vector& v) {
         for (int i = 0; i < N; ++i) {
             this->data[i] += v.data[i];
@@ -154,6 +133,8 @@ public:
 
 };
 
+#include "vector_simd.hpp"
+
 
 template <class T, int N>
 vector<T, N> operator+ (vector<T, N> a, const vector<T, N>& b) {
@@ -208,6 +189,37 @@ typedef vector<int, 2> vec2i;
 typedef vector<int, 3> vec3i;
 typedef vector<int, 4> vec4i;
 
+
+// A vec3 padded out to 16 bytes and 16 byte aligned. Use it for arrays that are
+// streamed through SIMD registers; the padding is kept at zero so a whole register
+// can be loaded and operated on without masking.
+struct alignas(16) vec3a {
+    float x, y, z, pad;
+
+    constexpr vec3a(float x = 0, float y = 0, float z = 0) : x(x), y(y), z(z), pad(0) { }
+    constexpr vec3a(const vec3& v) : x(v.data[0]), y(v.data[1]), z(v.data[2]), pad(0) { }
+
+    operator vec3() const {
+        return vec3{ x, y, z };
+    }
+
+    simd::float4 load() const {
+        return simd::load(&x);
+    }
+
+    void store(simd::float4 v) {
+        simd::store(&x, v);
+        pad = 0;
+    }
+};
+
+
+// Vectors are plain values: copies are memcpy/memmove and constants fold at compile time.
+static_assert(std::is_trivially_copyable<vec3>::value && std::is_trivially_copyable<vec4>::value && std::is_trivially_copyable<vec3a>::value, "vectors must be trivially copyable");
+static_assert(std::is_standard_layout<vec3>::value && std::is_standard_layout<vec4>::value && std::is_standard_layout<vec3a>::value, "vectors must be standard layout");
+static_assert(sizeof(vec2) == 8 && sizeof(vec3) == 12 && sizeof(vec4) == 16 && sizeof(vec3a) == 16, "vectors must be tightly packed");
+static_assert(std::get<2>(vec3{ 1.0f, 2.0f, 3.0f }.data) == 3.0f && std::get<3>(vec4(1.0f).data) == 1.0f && vec3a(vec3(2.0f)).z == 2.0f, "vectors must be constexpr constructible");
+
 static float angleBetween(const vec2& to, const vec2& from) {
     return std::atan2(to.y - from.y, to.x - from.x);
 }
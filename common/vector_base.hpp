@@ -1,12 +1,31 @@
 #pragma once
 #include <array>
+#include <utility>
+#include <initializer_list>
 
 
+// Compile time helpers so vectors can be built in constant expressions.
+namespace vector_detail {
+
+    template <class T, std::size_t... I>
+    constexpr std::array<T, sizeof...(I)> fill(T x, std::index_sequence<I...>) {
+        return {{ ((void)I, x)... }};
+    }
+
+    // Missing trailing elements are zero, extra elements are ignored.
+    template <class T, std::size_t... I>
+    constexpr std::array<T, sizeof...(I)> from_list(std::initializer_list<T> elements, std::index_sequence<I...>) {
+        return {{ (I < elements.size() ? elements.begin()[I] : T(0))... }};
+    }
+}
+
 
 template <class T, int N>
 class Vector_data {
 public:
     std::array<T, N> data;
+
+    constexpr Vector_data(const std::array<T, N>& data) : data(data) { }
 };
 
 
@@ -18,6 +37,8 @@ public:
         std::array<T, 2> data;
         struct { T x, y; };
     };
+
+    constexpr Vector_data(const std::array<T, 2>& data) : data(data) { }
 };
 
 
@@ -28,14 +49,20 @@ public:
         std::array<T, 3> data;
         struct { T x, y, z; };
     };
+
+    constexpr Vector_data(const std::array<T, 3>& data) : data(data) { }
 };
 
 
+// Four component vectors are aligned to their size (up to 16 bytes) so that
+// vec4 always lives in a single SIMD register sized slot.
 template <class T>
-class Vector_data<T, 4> {
+class alignas(sizeof(T) * 4 < 16 ? sizeof(T) * 4 : 16) Vector_data<T, 4> {
 public:
     union {
         std::array<T, 4> data;
         struct { T x, y, z, w; };
     };
+
+    constexpr Vector_data(const std::array<T, 4>& data) : data(data) { }
 };
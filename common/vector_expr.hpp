@@ -0,0 +1,164 @@
+#pragma once
+#include <type_traits>
+#include <utility>
+#include "vector.hpp"
+#include "matrix.hpp"
+
+// Opt-in expression templates for element-wise vector and matrix arithmetic.
+//
+// Wrapping operands in lazy() makes the operators build a small expression tree
+// instead of a temporary per operation. Assigning or converting the tree to a
+// plain vector/matrix evaluates the whole thing in a single loop:
+//
+//     vec3 p = lazy(a) * (1 - t) + lazy(b) * t;
+//
+// Leaves hold references, so an expression must not outlive its operands.
+// Products of two matrices are deliberately not element-wise here; use the
+// regular operator* for those.
+
+namespace expr {
+
+    // Base of every node, so the operators only match expression types.
+    template <class E>
+    struct expression {
+        const E& self() const {
+            return static_cast<const E&>(*this);
+        }
+    };
+
+
+    template <class V>
+    struct is_matrix : std::false_type { };
+
+    template <class T, int Rows, int Cols>
+    struct is_matrix<matrix<T, Rows, Cols>> : std::true_type { };
+
+
+    template <class T, int N>
+    vector<T, N> blank(const vector<T, N>*) {
+        return vector<T, N>();
+    }
+
+    template <class T, int Rows, int Cols>
+    matrix<T, Rows, Cols> blank(const matrix<T, Rows, Cols>*) {
+        return matrix<T, Rows, Cols>(uninitialized);
+    }
+
+
+    // A vector or matrix operand, by reference.
+    template <class V>
+    struct leaf : expression<leaf<V>> {
+        typedef V result_type;
+        static const int size = std::tuple_size<decltype(V::data)>::value;
+
+        const V& v;
+
+        explicit leaf(const V& v) : v(v) { }
+
+        auto operator[](int i) const -> decltype(v.data[i]) {
+            return v.data[i];
+        }
+    };
+
+    // A scalar operand, applied to every element.
+    template <class T>
+    struct scalar : expression<scalar<T>> {
+        typedef void result_type;
+        static const int size = 0;
+
+        T s;
+
+        explicit scalar(T s) : s(s) { }
+
+        T operator[](int) const {
+            return s;
+        }
+    };
+
+
+    struct add { template <class A, class B> static auto apply(A a, B b) -> decltype(a + b) { return a + b; } };
+    struct sub { template <class A, class B> static auto apply(A a, B b) -> decltype(a - b) { return a - b; } };
+    struct mul { template <class A, class B> static auto apply(A a, B b) -> decltype(a * b) { return a * b; } };
+    struct div { template <class A, class B> static auto apply(A a, B b) -> decltype(a / b) { return a / b; } };
+
+
+    template <class Op, class L, class R>
+    struct binary : expression<binary<Op, L, R>> {
+        typedef typename std::conditional<std::is_void<typename L::result_type>::value,
+                                          typename R::result_type,
+                                          typename L::result_type>::type result_type;
+        static const int size = L::size ? L::size : R::size;
+
+        static_assert(L::size == 0 || R::size == 0 || L::size == R::size, "Operands must have the same number of elements");
+        static_assert(!(std::is_same<Op, mul>::value || std::is_same<Op, div>::value) || L::size == 0 || R::size == 0 || !is_matrix<result_type>::value,
+                      "Element-wise matrix products are not supported, use the eager operator*");
+
+        L l;
+        R r;
+
+        binary(const L& l, const R& r) : l(l), r(r) { }
+
+        auto operator[](int i) const -> decltype(Op::apply(l[i], r[i])) {
+            return Op::apply(l[i], r[i]);
+        }
+
+        // Evaluate the whole expression in one pass. The pass is unrolled at compile
+        // time so the result can stay in registers.
+        operator result_type() const {
+            return evaluate(std::make_integer_sequence<int, size>());
+        }
+
+        result_type eval() const {
+            return *this;
+        }
+
+    private:
+        template <int... I>
+        result_type evaluate(std::integer_sequence<int, I...>) const {
+            result_type out = blank(static_cast<const result_type*>(nullptr));
+            int unpack[] = { (out.data[I] = (*this)[I], 0)... };
+            (void)unpack;
+            return out;
+        }
+    };
+
+
+    template <class T, int N>
+    leaf<vector<T, N>> lazy(const vector<T, N>& v) {
+        return leaf<vector<T, N>>(v);
+    }
+
+    template <class T, int Rows, int Cols>
+    leaf<matrix<T, Rows, Cols>> lazy(const matrix<T, Rows, Cols>& m) {
+        return leaf<matrix<T, Rows, Cols>>(m);
+    }
+
+
+#define EXPR_OPERATOR(op, name)                                                                 \
+    template <class L, class R>                                                                 \
+    binary<name, L, R> operator op(const expression<L>& l, const expression<R>& r) {            \
+        return binary<name, L, R>(l.self(), r.self());                                          \
+    }                                                                                           \
+    template <class L, class T, class = typename std::enable_if<std::is_arithmetic<T>::value>::type> \
+    binary<name, L, scalar<T>> operator op(const expression<L>& l, T r) {                       \
+        return binary<name, L, scalar<T>>(l.self(), scalar<T>(r));                              \
+    }                                                                                           \
+    template <class T, class R, class = typename std::enable_if<std::is_arithmetic<T>::value>::type> \
+    binary<name, scalar<T>, R> operator op(T l, const expression<R>& r) {                       \
+        return binary<name, scalar<T>, R>(scalar<T>(l), r.self());                              \
+    }
+
+    EXPR_OPERATOR(+, add)
+    EXPR_OPERATOR(-, sub)
+    EXPR_OPERATOR(*, mul)
+    EXPR_OPERATOR(/, div)
+
+#undef EXPR_OPERATOR
+
+
+    // Fused equivalent of ::lerp for vectors and matrices.
+    template <class T>
+    T lerp(const T& a, const T& b, float x) {
+        return lazy(a) * (1 - x) + lazy(b) * x;
+    }
+}
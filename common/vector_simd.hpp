@@ -0,0 +1,107 @@
+#pragma once
+#include "simd.hpp"
+#include <type_traits>
+
+// Explicit SSE/AVX specializations of the hot vector<float, 3> and vector<float, 4>
+// operations. Only included from vector.hpp, after the generic template. When no
+// SIMD instruction set is available the generic loops are used unchanged.
+
+#if defined(SIMD_SSE2)
+
+namespace vector_simd {
+
+    inline simd::float4 load(const vector<float, 3>& v) {
+        return simd::load3(v.data.data());
+    }
+
+    inline simd::float4 load(const vector<float, 4>& v) {
+        return simd::load(v.data.data());
+    }
+
+    inline void store(vector<float, 3>& v, simd::float4 a) {
+        simd::store3(v.data.data(), a);
+    }
+
+    inline void store(vector<float, 4>& v, simd::float4 a) {
+        simd::store(v.data.data(), a);
+    }
+
+    inline simd::float4 dot(simd::float4 a, simd::float4 b, std::integral_constant<int, 3>) {
+        return simd::dot3(a, b);
+    }
+
+    inline simd::float4 dot(simd::float4 a, simd::float4 b, std::integral_constant<int, 4>) {
+        return simd::dot4(a, b);
+    }
+}
+
+
+#define VECTOR_SIMD_SPECIALIZE(N)                                                                       \
+    template <> inline vector<float, N>& vector<float, N>::operator+=(const vector& v) {                \
+        vector_simd::store(*this, vector_simd::load(*this) + vector_simd::load(v));                     \
+        return *this;                                                                                   \
+    }                                                                                                   \
+    template <> inline vector<float, N>& vector<float, N>::operator-=(const vector& v) {                \
+        vector_simd::store(*this, vector_simd::load(*this) - vector_simd::load(v));                     \
+        return *this;                                                                                   \
+    }                                                                                                   \
+    template <> inline vector<float, N>& vector<float, N>::operator*=(const vector& v) {                \
+        vector_simd::store(*this, vector_simd::load(*this) * vector_simd::load(v));                     \
+        return *this;                                                                                   \
+    }                                                                                                   \
+    template <> inline vector<float, N>& vector<float, N>::operator/=(const vector& v) {                \
+        vector_simd::store(*this, vector_simd::load(*this) / vector_simd::load(v));                     \
+        return *this;                                                                                   \
+    }                                                                                                   \
+    template <> inline vector<float, N>& vector<float, N>::operator+=(const float& s) {                 \
+        vector_simd::store(*this, vector_simd::load(*this) + simd::set1(s));                            \
+        return *this;                                                                                   \
+    }                                                                                                   \
+    template <> inline vector<float, N>& vector<float, N>::operator-=(const float& s) {                 \
+        vector_simd::store(*this, vector_simd::load(*this) - simd::set1(s));                            \
+        return *this;                                                                                   \
+    }                                                                                                   \
+    template <> inline vector<float, N>& vector<float, N>::operator*=(const float& s) {                 \
+        vector_simd::store(*this, vector_simd::load(*this) * simd::set1(s));                            \
+        return *this;                                                                                   \
+    }                                                                                                   \
+    template <> inline vector<float, N>& vector<float, N>::operator/=(const float& s) {                 \
+        vector_simd::store(*this, vector_simd::load(*this) / simd::set1(s));                            \
+        return *this;                                                                                   \
+    }                                                                                                   \
+    template <> inline vector<float, N> vector<float, N>::operator-() const {                           \
+        vector negate;                                                                                  \
+        vector_simd::store(negate, -vector_simd::load(*this));                                          \
+        return negate;                                                                                  \
+    }                                                                                                   \
+    template <> inline float vector<float, N>::dot(const vector& v) const {                             \
+        simd::float4 a = vector_simd::load(*this);                                                      \
+        return simd::first(vector_simd::dot(a, vector_simd::load(v), std::integral_constant<int, N>())); \
+    }                                                                                                   \
+    template <> inline float vector<float, N>::lengthSquared() const {                                  \
+        simd::float4 a = vector_simd::load(*this);                                                      \
+        return simd::first(vector_simd::dot(a, a, std::integral_constant<int, N>()));                   \
+    }                                                                                                   \
+    template <> inline float vector<float, N>::length() const {                                         \
+        simd::float4 a = vector_simd::load(*this);                                                      \
+        return simd::first(simd::sqrt(vector_simd::dot(a, a, std::integral_constant<int, N>())));       \
+    }                                                                                                   \
+    template <> inline void vector<float, N>::normalize() {                                             \
+        simd::float4 a = vector_simd::load(*this);                                                      \
+        simd::float4 l = simd::sqrt(vector_simd::dot(a, a, std::integral_constant<int, N>()));          \
+        vector_simd::store(*this, a / l);                                                               \
+    }
+
+VECTOR_SIMD_SPECIALIZE(3)
+VECTOR_SIMD_SPECIALIZE(4)
+
+#undef VECTOR_SIMD_SPECIALIZE
+
+template <> template <>
+inline vector<float, 3> vector<float, 3>::cross<float>(const vector& v) const {
+    vector result;
+    vector_simd::store(result, simd::cross3(vector_simd::load(*this), vector_simd::load(v)));
+    return result;
+}
+
+#endif
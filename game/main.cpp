@@ -5,14 +5,19 @@
 #include <fstream>
 #include <streambuf>
 #include <vector>
+#include <random>
 #include <chaiscript/chaiscript.hpp>
 #include <assimp/Importer.hpp>
 #include <assimp/scene.h>
 #include <assimp/postprocess.h>
 #include <maths.hpp>
 #include <rendering.hpp>
+#include <render_queue.hpp>
+#include <frame_pipeline.hpp>
+#include <fixed_timestep.hpp>
 #include <io.hpp>
 #include <nodes/camera.hpp>
+#include <nodes/entity_batch.hpp>
 
 #define WINDOW_TITLE        "Space"
 
@@ -41,6 +46,7 @@ mesh load_mesh(const std::string& filename) {
                 aiVector3D n = obj->mNormals[v];
                 verts.push_back(vec3{ p.x, p.y, p.z });
                 normals.push_back(vec3{ n.x, n.y, n.z });
+                mesh.bounds.merge(verts.back());
             }
         }
 
@@ -72,10 +78,27 @@ mesh load_mesh(const std::string& filename) {
 }
 
 
+/* Asteroids are entities rather than nodes: there are thousands of them, and each
+ * one is only a tumbling transform.
+ */
+struct asteroid {
+    vec3 position, spin;
+    float scale;
+};
+
+/* An entity's transform before the last tick, to draw frames between ticks from.
+ * Entities are not in the scene's transforms(), so they keep it themselves.
+ */
+struct last_transform {
+    affine3 world;
+};
+
+
 /* game_options holds all of the current settings applied to the game.
  */
 struct game_options {
     int width, height; /* The current operating resolution. */
+    double tick_rate; /* Simulation ticks per second, however fast frames are drawn. */
 };
 
 /* The main entry point into the game.
@@ -89,7 +112,8 @@ int main(int argc, char** argv) {
 
     game_options options = {
         1280,
-        720
+        720,
+        60.0
     };
 
     /* TODO: Parse the command line and configuration file options. */
@@ -124,36 +148,164 @@ int main(int argc, char** argv) {
     glEnable(GL_DEPTH_TEST);
     mesh model = load_mesh("models/cube.dae");
 
-    node root;
-    camera viewport;
+    scene graph; /* Outlives every node in it. */
+    node root(graph);
+    camera viewport(graph);
     root.add(&viewport);
 
     viewport.position = { -5.0f, 2.0f, -3.0f };
     viewport.direction = { 5.0f, -2.0f, 3.0f };
     viewport.up = { 0.0f, 1.0f, 0.0f };
 
+    job_system jobs;
+
+    ecs::world entities;
+    std::mt19937 rng(1);
+    std::uniform_real_distribution<float> d(-1.0f, 1.0f);
+    for (int i = 0; i < 2000; ++i) {
+        asteroid a{ vec3{ d(rng) * 50.0f, d(rng) * 5.0f, d(rng) * 50.0f }, vec3{ d(rng), d(rng), d(rng) }, 0.1f + 0.2f * std::fabs(d(rng)) };
+        affine3 t(a.position, quat(), vec3(a.scale));
+        entities.create(a, quat(), t, last_transform{ t });
+    }
+    entities.sync();
+
+    ecs::query<const asteroid, quat, affine3, last_transform> tumbling(entities);
+    entities.add_system([&](ecs::world&, float dt) {
+        tumbling.each_chunk(jobs, [dt](int count, const ecs::entity*, const asteroid* a, quat* q, affine3* t, last_transform* last) {
+            for (int i = 0; i < count; ++i) {
+                last[i].world = t[i];
+                integrate(&q[i], &a[i].spin, 1, dt);
+                t[i] = affine3(a[i].position, q[i], vec3(a[i].scale));
+            }
+        });
+    });
+
+    /* One pass over the asteroid chunks draws the whole field, rewound towards the
+     * last tick the same way node::world_matrix() rewinds nodes.
+     */
+    entity_batch<const affine3, const last_transform> field(graph, entities, [&](const node::render_state& rs, int count, const ecs::entity*, const affine3* t, const last_transform* last) {
+        vec3 light = rs.relative(vec3d{ 2.0, 0.5, -2.0 }); /* Lights are large-world points. */
+        float alpha = 1.0f - rs.rewind;
+        auto placed = [&](int i) {
+            if (rs.rewind <= 0.0f) {
+                return rs.world * t[i].to_mat4();
+            }
+            affine3 w(uninitialized);
+            for (int k = 0; k < 12; ++k) {
+                w.data[k] = lerp(last[i].world.data[k], t[i].data[k], alpha);
+            }
+            return rs.world * w.to_mat4();
+        };
+        if (rs.queue) {
+            rs.queue->prepare(shader, [&shader, light] {
+                shader["camera_position"] = vec3(0.0f); /* Rendering is camera relative. */
+                shader["light_position"] = light;
+            });
+            for (int i = 0; i < count; ++i) {
+                rs.queue->submit(shader, model, placed(i));
+            }
+            return;
+        }
+
+        shader.use();
+        shader["transform"] = rs.projection * rs.view;
+        shader["camera_position"] = vec3(0.0f);
+        shader["light_position"] = light;
+        gl::uniform& world = shader["world"];
+        gl::uniform& normal_matrix = shader["normal_matrix"];
+        for (int i = 0; i < count; ++i) {
+            mat4 m = placed(i);
+            world = m;
+            normal_matrix = affine3(m).normal_matrix();
+            model.draw(shader["albedo"], shader["roughness"], shader["metalness"]);
+        }
+    });
+    viewport.add(&field);
+
     float time = 0;
 
+    /* One tick of the game, and everything it moved brought up to date. */
+    auto simulate = [&](float dt) {
+        /* TODO: Update the game logic here. */
+        graph.update_sleep(dt); /* Wakes sleeping nodes that are due, before the update skips the rest. */
+        root.update_parallel(dt, jobs);
+        entities.update(dt);
+        graph.transforms().update(); /* Only recomputes the world transforms of nodes that moved. */
+        graph.update_space(); /* Keeps the bounds used for culling with the nodes. */
+        time += dt;
+    };
+
+    /* Up to 5 ticks catch up after a slow frame; a longer backlog is dropped. */
+    fixed_timestep timestep(options.tick_rate, 5);
+
+    /* Pipelined, the next frame is simulated on a job while this thread renders the
+     * last one from the render queue it was extracted into.
+     */
+    frame_pipeline<render_queue> pipeline(jobs);
+    bool pipelined = false;
+
     running = true;
     while (running) {
+        pipeline.finish(); /* The scene is this thread's again until the next start(). */
+        jobs.run_main_jobs(); /* GL work scheduled by the update. */
+
         while (SDL_PollEvent(&event)) {
             switch (event.type) {
             case SDL_QUIT:
                 running = false;
                 break;
 
+            case SDL_KEYDOWN:
+                if (event.key.keysym.sym == SDLK_c) { /* A/B the cost of frustum culling. */
+                    viewport.culling = !viewport.culling;
+                    printf("culling %s; last frame drew %d, culled %d of %d tested\n", viewport.culling ? "on" : "off",
+                           viewport.stats.drawn, viewport.stats.culled, viewport.stats.tested);
+                }
+                if (event.key.keysym.sym == SDLK_q) { /* A/B the sorted render queue. */
+                    const render_queue::stats& q = (pipelined ? pipeline.front() : viewport.queue).last_frame();
+                    viewport.sorting = !viewport.sorting;
+                    printf("render queue %s; last frame %d draws, %d/%d/%d program/array/material changes, %d/%d/%d unsorted\n",
+                           viewport.sorting ? "on" : "off", q.draws, q.programs, q.arrays, q.materials,
+                           q.unsorted_programs, q.unsorted_arrays, q.unsorted_materials);
+                }
+                if (event.key.keysym.sym == SDLK_z) { /* How much of the scene is asleep. */
+                    scene::sleep_stats s = graph.count_sleep();
+                    printf("%d of %d nodes active, %d asleep; woken by %d events, %d timers, %d proximity\n", s.active, s.total, s.asleep,
+                           s.woken[sleep_schedule::event], s.woken[sleep_schedule::timer], s.woken[sleep_schedule::proximity]);
+                }
+                if (event.key.keysym.sym == SDLK_p) { /* A/B overlapping simulation and rendering. */
+                    pipelined = !pipelined;
+                    printf("pipelining %s\n", pipelined ? "on" : "off");
+                }
+                break;
+
             default:
                 break;
             }
         }
 
-        /* TODO: Update the game logic here. */
-        root.update(1.0f);
-
-        /* TODO: Render the game to the screen here. */
-        root.draw();
+        /* Frames land between ticks, so they are drawn rewound towards the tick before. */
+        int ticks = timestep.advance();
+        float dt = timestep.dt(), rewind = 1.0f - timestep.alpha();
+        if (pipelined) {
+            pipeline.start([&, ticks, dt, rewind](render_queue& next) {
+                for (int i = 0; i < ticks; ++i) {
+                    simulate(dt);
+                }
+                viewport.extract(next, rewind);
+            });
+            camera::render(pipeline.front());
+        } else {
+            for (int i = 0; i < ticks; ++i) {
+                simulate(dt);
+            }
+            jobs.run_main_jobs();
 
-        time += 0.01f;
+            /* TODO: Render the game to the screen here. */
+            node::render_state rs = node::render_state();
+            rs.rewind = rewind;
+            root.draw(rs);
+        }
 
         //model.draw(shader.get("diffuse"));
 
@@ -0,0 +1,461 @@
+#include <cstdio>
+#include <chrono>
+#include <vector>
+#include <random>
+#include <string>
+#include <cstring>
+#include <maths.hpp>
+#include <job_system.hpp>
+#include <vector_expr.hpp>
+#include <fast_math.hpp>
+
+/* Headless micro benchmarks for the maths library. The same source is built twice,
+ * as math_bench (SIMD specializations enabled) and math_bench_scalar (SIMD_SCALAR,
+ * the generic vector templates), so the two outputs can be compared directly.
+ * Needs no window or GL context.
+ *
+ * Every result is reported as ns/op and as GB/s over the bytes each operation reads
+ * and writes. "--json <file>" also writes them as JSON for diffing between builds;
+ * "--json -" writes the JSON to stdout instead of the table.
+ */
+
+static const int elements = 1000000;
+static const int repeats = 20;
+
+static float sink = 0.0f;
+
+template <class Fn>
+double time_ns(Fn fn) {
+    fn(); // warm the caches
+    auto start = std::chrono::high_resolution_clock::now();
+    for (int r = 0; r < repeats; ++r) {
+        fn();
+    }
+    auto end = std::chrono::high_resolution_clock::now();
+    return std::chrono::duration<double, std::nano>(end - start).count() / repeats;
+}
+
+struct result {
+    std::string name;
+    int count;
+    double ns, bytes;
+};
+
+struct metric {
+    std::string name;
+    double value;
+};
+
+static std::vector<result> results;
+static std::vector<metric> metrics;
+static bool quiet = false;
+
+// Records count operations taking ns in total, each reading and writing bytes.
+void report(const char* name, double ns, double bytes, int count = elements) {
+    results.push_back(result{ name, count, ns, bytes });
+    if (!quiet) {
+        printf("%-24s %10.3f ms %8.3f ns/op %10.1f Mop/s %8.2f GB/s\n", name, ns * 1e-6, ns / count, count / ns * 1e3, bytes * count / ns);
+    }
+}
+
+void report_metric(const char* name, double value) {
+    metrics.push_back(metric{ name, value });
+    if (!quiet) {
+        printf("%-24s %10.3g\n", name, value);
+    }
+}
+
+std::string json_string(const std::string& s) {
+    std::string out = "\"";
+    for (char c : s) {
+        if (c == '"' || c == '\\') {
+            out += '\\';
+        }
+        out += c;
+    }
+    return out + "\"";
+}
+
+void write_json(FILE* f) {
+    fprintf(f, "{\n  \"simd\": %s,\n  \"elements\": %d,\n  \"repeats\": %d,\n  \"results\": [", json_string(simd::name).c_str(), elements, repeats);
+    for (size_t i = 0; i < results.size(); ++i) {
+        const result& r = results[i];
+        fprintf(f, "%s\n    { \"name\": %s, \"count\": %d, \"ns_per_op\": %.4f, \"bytes_per_op\": %.0f, \"gb_per_s\": %.4f }",
+            i ? "," : "", json_string(r.name).c_str(), r.count, r.ns / r.count, r.bytes, r.bytes * r.count / r.ns);
+    }
+    fprintf(f, "\n  ],\n  \"metrics\": [");
+    for (size_t i = 0; i < metrics.size(); ++i) {
+        fprintf(f, "%s\n    { \"name\": %s, \"value\": %.6g }", i ? "," : "", json_string(metrics[i].name).c_str(), metrics[i].value);
+    }
+    fprintf(f, "\n  ]\n}\n");
+}
+
+template <class V>
+std::vector<V> random_vectors(std::mt19937& rng) {
+    std::uniform_real_distribution<float> dist(-100.0f, 100.0f);
+    std::vector<V> v(elements);
+    for (V& e : v) {
+        for (float& f : e.data) {
+            f = dist(rng);
+        }
+    }
+    return v;
+}
+
+template <class V>
+void bench_vectors(const char* type, std::mt19937& rng) {
+    std::vector<V> a = random_vectors<V>(rng), b = random_vectors<V>(rng), out(elements);
+    char name[64];
+
+    snprintf(name, sizeof(name), "%s array copy", type);
+    report(name, time_ns([&] { out = a; }), 2 * sizeof(V));
+
+    snprintf(name, sizeof(name), "%s add", type);
+    report(name, time_ns([&] { for (int i = 0; i < elements; ++i) out[i] = a[i] + b[i]; }), 3 * sizeof(V));
+
+    snprintf(name, sizeof(name), "%s mul scalar", type);
+    report(name, time_ns([&] { for (int i = 0; i < elements; ++i) out[i] = a[i] * 0.5f; }), 2 * sizeof(V));
+
+    snprintf(name, sizeof(name), "%s div", type);
+    report(name, time_ns([&] { for (int i = 0; i < elements; ++i) out[i] = a[i] / b[i]; }), 3 * sizeof(V));
+
+    snprintf(name, sizeof(name), "%s dot", type);
+    report(name, time_ns([&] { float s = 0; for (int i = 0; i < elements; ++i) s += a[i].dot(b[i]); sink += s; }), 2 * sizeof(V));
+
+    snprintf(name, sizeof(name), "%s length", type);
+    report(name, time_ns([&] { float s = 0; for (int i = 0; i < elements; ++i) s += a[i].length(); sink += s; }), sizeof(V));
+
+    snprintf(name, sizeof(name), "%s normalized", type);
+    report(name, time_ns([&] { for (int i = 0; i < elements; ++i) out[i] = a[i].normalized(); }), 2 * sizeof(V));
+}
+
+void bench_cross(std::mt19937& rng) {
+    std::vector<vec3> a = random_vectors<vec3>(rng), b = random_vectors<vec3>(rng), out(elements);
+    report("vec3 cross", time_ns([&] { for (int i = 0; i < elements; ++i) out[i] = a[i].cross(b[i]); }), 3 * sizeof(vec3));
+}
+
+std::vector<mat4> random_matrices(std::mt19937& rng, int count) {
+    std::uniform_real_distribution<float> dist(-1.0f, 1.0f);
+    std::vector<mat4> m(count, mat4(uninitialized));
+    for (mat4& e : m) {
+        for (float& f : e.data) {
+            f = dist(rng);
+        }
+    }
+    return m;
+}
+
+void bench_matrices(std::mt19937& rng) {
+    std::vector<mat4> a = random_matrices(rng, elements), out(elements, mat4(uninitialized));
+    std::vector<vec4> v = random_vectors<vec4>(rng), vout(elements);
+    mat4 vp = random_matrices(rng, 1)[0];
+
+    report("mat4 * mat4", time_ns([&] { for (int i = 0; i < elements; ++i) out[i] = vp * a[i]; }), 2 * sizeof(mat4));
+    report("mat4 *= mat4", time_ns([&] { for (int i = 0; i < elements; ++i) { out[i] = a[i]; out[i] *= vp; } }), 2 * sizeof(mat4));
+    report("mat4 * mat4 batch", time_ns([&] { multiply(vp, a.data(), out.data(), elements); }), 2 * sizeof(mat4));
+    report("mat4 * vec4", time_ns([&] { for (int i = 0; i < elements; ++i) vout[i] = vp * v[i]; }), 2 * sizeof(vec4));
+    report("mat4 * vec4 batch", time_ns([&] { transform(vp, v.data(), vout.data(), elements); }), 2 * sizeof(vec4));
+}
+
+// The matrix constructors the camera and scene graph call every frame.
+void bench_transforms(std::mt19937& rng) {
+    std::vector<vec3> eye = random_vectors<vec3>(rng), target = random_vectors<vec3>(rng), axis = random_vectors<vec3>(rng);
+    std::vector<mat4> out(elements, mat4(uninitialized));
+    std::uniform_real_distribution<float> fov(0.5f, 2.0f), angle(-pi, pi);
+    std::vector<float> f(elements), a(elements);
+    for (int i = 0; i < elements; ++i) {
+        f[i] = fov(rng);
+        a[i] = angle(rng);
+        axis[i].normalize();
+    }
+    vec3 up{ 0.0f, 1.0f, 0.0f };
+
+    report("look_at", time_ns([&] { for (int i = 0; i < elements; ++i) out[i] = look_at(eye[i], target[i], up); }), 2 * sizeof(vec3) + sizeof(mat4));
+    report("perspective", time_ns([&] { for (int i = 0; i < elements; ++i) out[i] = perspective(f[i], 16.0f / 9.0f, 0.1f, 1000.0f); }), sizeof(float) + sizeof(mat4));
+    report("rotate", time_ns([&] { for (int i = 0; i < elements; ++i) out[i] = rotate(a[i], axis[i]); }), sizeof(float) + sizeof(vec3) + sizeof(mat4));
+    report("translate rotate scale", time_ns([&] {
+        for (int i = 0; i < elements; ++i) out[i] = translate(eye[i]) * rotate(a[i], axis[i]) * scale(target[i]);
+    }), 3 * sizeof(vec3) + sizeof(float) + sizeof(mat4));
+}
+
+void bench_streams(std::mt19937& rng) {
+    std::vector<vec3> p = random_vectors<vec3>(rng), out(elements);
+    std::vector<vec4> clip(elements);
+    std::vector<float> x(elements), y(elements), z(elements), ox(elements), oy(elements), oz(elements), ow(elements);
+    for (int i = 0; i < elements; ++i) {
+        x[i] = p[i].x;
+        y[i] = p[i].y;
+        z[i] = p[i].z;
+    }
+    mat4 m = translate(1.0f, 2.0f, 3.0f) * rotate(0.5f, vec3{ 0.0f, 1.0f, 0.0f });
+    mat4 vp = perspective(pi / 4, 1.0f, 1.0f, 100.0f) * m;
+
+    report("vec3 points loop", time_ns([&] {
+        for (int i = 0; i < elements; ++i) {
+            vec4 r = m * vec4{ p[i].x, p[i].y, p[i].z, 1.0f };
+            out[i] = vec3{ r.x, r.y, r.z };
+        }
+    }), 2 * sizeof(vec3));
+    report("transform_points", time_ns([&] { transform_points(m, p.data(), out.data(), elements); }), 2 * sizeof(vec3));
+    report("transform_directions", time_ns([&] { transform_directions(m, p.data(), out.data(), elements); }), 2 * sizeof(vec3));
+    report("transform_points soa", time_ns([&] { transform_points(m, { x.data(), y.data(), z.data() }, { ox.data(), oy.data(), oz.data() }, elements); }), 2 * sizeof(vec3));
+    report("project_points", time_ns([&] { project_points(vp, p.data(), clip.data(), elements); }), sizeof(vec3) + sizeof(vec4));
+    report("project_points soa", time_ns([&] { project_points(vp, { x.data(), y.data(), z.data() }, { ox.data(), oy.data(), oz.data(), ow.data() }, elements); }), sizeof(vec3) + sizeof(vec4));
+    job_system jobs;
+    report("transform_points mt", time_ns([&] {
+        jobs.parallel_for(0, elements, 65536, [&](int begin, int end) {
+            transform_points(m, p.data() + begin, out.data() + begin, end - begin);
+        });
+    }), 2 * sizeof(vec3));
+}
+
+// The same particle update on std::vector<vec3> and on soa_stream<vec3>.
+void bench_soa(std::mt19937& rng) {
+    std::vector<vec3> p = random_vectors<vec3>(rng), v = random_vectors<vec3>(rng);
+    soa_stream<vec3> sp(p.data(), elements), sv(v.data(), elements);
+    std::vector<float> d(elements);
+    const float dt = 1.0f / 60.0f;
+
+    report("vec3 axpy", time_ns([&] { for (int i = 0; i < elements; ++i) p[i] += v[i] * dt; }), 3 * sizeof(vec3));
+    report("soa axpy", time_ns([&] { axpy(dt, sv, sp); }), 3 * sizeof(vec3));
+    report("vec3 normalize", time_ns([&] { for (int i = 0; i < elements; ++i) v[i].normalize(); }), 2 * sizeof(vec3));
+    report("soa normalize_all", time_ns([&] { normalize_all(sv); }), 2 * sizeof(vec3));
+    report("vec3 dot to array", time_ns([&] { for (int i = 0; i < elements; ++i) d[i] = p[i].dot(v[i]); }), 2 * sizeof(vec3) + sizeof(float));
+    report("soa dot_all", time_ns([&] { dot_all(sp, sv, d.data()); }), 2 * sizeof(vec3) + sizeof(float));
+    report("aabb merge", time_ns([&] { aabb b = aabb::empty(); for (int i = 0; i < elements; ++i) b.merge(p[i]); sink += b.min.x; }), sizeof(vec3));
+    report("soa min_max", time_ns([&] { vec3 lo, hi; min_max(sp, lo, hi); sink += lo.x + hi.x; }), sizeof(vec3));
+    report("soa interleave", time_ns([&] { sp.interleave(p.data()); }), 2 * sizeof(vec3));
+    report("soa assign", time_ns([&] { sp.assign(p.data(), elements); }), 2 * sizeof(vec3));
+}
+
+void bench_lerp(std::mt19937& rng) {
+    std::vector<vec3> a = random_vectors<vec3>(rng), b = random_vectors<vec3>(rng), c = random_vectors<vec3>(rng), d = random_vectors<vec3>(rng), out(elements);
+    std::vector<vec4> a4 = random_vectors<vec4>(rng), b4 = random_vectors<vec4>(rng), out4(elements);
+    std::vector<mat4> am = random_matrices(rng, elements / 8), bm = random_matrices(rng, elements / 8), outm(elements / 8, mat4(uninitialized));
+    std::vector<float> t(elements);
+    std::uniform_real_distribution<float> dist(0.0f, 1.0f);
+    for (float& x : t) {
+        x = dist(rng);
+    }
+
+    report("vec3 lerp", time_ns([&] { for (int i = 0; i < elements; ++i) out[i] = lerp(a[i], b[i], t[i]); }), 3 * sizeof(vec3) + sizeof(float));
+    report("vec3 lerp expr", time_ns([&] { for (int i = 0; i < elements; ++i) out[i] = expr::lerp(a[i], b[i], t[i]); }), 3 * sizeof(vec3) + sizeof(float));
+    report("vec4 lerp", time_ns([&] { for (int i = 0; i < elements; ++i) out4[i] = lerp(a4[i], b4[i], t[i]); }), 3 * sizeof(vec4) + sizeof(float));
+    report("vec4 lerp expr", time_ns([&] { for (int i = 0; i < elements; ++i) out4[i] = expr::lerp(a4[i], b4[i], t[i]); }), 3 * sizeof(vec4) + sizeof(float));
+    // matrix has no eager element-wise operators, so there is nothing to compare against.
+    report("mat4 lerp expr (n/8)", time_ns([&] { for (int i = 0; i < elements / 8; ++i) outm[i] = expr::lerp(am[i], bm[i], t[i]); }), 3 * sizeof(mat4) + sizeof(float), elements / 8);
+
+    // A cubic bezier, the kind of chained blend animation curves are built from.
+    report("vec3 bezier", time_ns([&] {
+        for (int i = 0; i < elements; ++i) {
+            float s = t[i], u = 1 - s;
+            out[i] = a[i] * (u * u * u) + b[i] * (3 * u * u * s) + c[i] * (3 * u * s * s) + d[i] * (s * s * s);
+        }
+    }), 5 * sizeof(vec3) + sizeof(float));
+    report("vec3 bezier expr", time_ns([&] {
+        using expr::lazy;
+        for (int i = 0; i < elements; ++i) {
+            float s = t[i], u = 1 - s;
+            out[i] = lazy(a[i]) * (u * u * u) + lazy(b[i]) * (3 * u * u * s) + lazy(c[i]) * (3 * u * s * s) + lazy(d[i]) * (s * s * s);
+        }
+    }), 5 * sizeof(vec3) + sizeof(float));
+}
+
+std::vector<quat> random_quats(std::mt19937& rng, int count) {
+    std::uniform_real_distribution<float> dist(-1.0f, 1.0f);
+    std::vector<quat> q(count);
+    for (quat& e : q) {
+        e = quat(dist(rng), dist(rng), dist(rng), dist(rng)).normalized();
+    }
+    return q;
+}
+
+void bench_quats(std::mt19937& rng) {
+    std::vector<quat> a = random_quats(rng, elements), b = random_quats(rng, elements), out(elements);
+    std::vector<vec3> w = random_vectors<vec3>(rng), axis(elements);
+    std::vector<float> angle(elements);
+    std::vector<mat4> m(elements, mat4(uninitialized));
+    std::uniform_real_distribution<float> dist(-pi, pi);
+    for (int i = 0; i < elements; ++i) {
+        axis[i] = w[i].normalized();
+        angle[i] = dist(rng);
+    }
+
+    report("quat * quat", time_ns([&] { for (int i = 0; i < elements; ++i) out[i] = a[i] * b[i]; }), 3 * sizeof(quat));
+    report("quat nlerp", time_ns([&] { for (int i = 0; i < elements; ++i) out[i] = nlerp(a[i], b[i], 0.3f); }), 3 * sizeof(quat));
+    report("quat slerp", time_ns([&] { for (int i = 0; i < elements; ++i) out[i] = slerp(a[i], b[i], 0.3f); }), 3 * sizeof(quat));
+    report("quat integrate", time_ns([&] { integrate(a.data(), w.data(), elements, 0.0001f); }), 2 * sizeof(quat) + sizeof(vec3));
+    report("rotate(angle, axis)", time_ns([&] { for (int i = 0; i < elements; ++i) m[i] = rotate(angle[i], axis[i]); }), sizeof(float) + sizeof(vec3) + sizeof(mat4));
+    report("quat to_mat4", time_ns([&] { for (int i = 0; i < elements; ++i) m[i] = a[i].to_mat4(); }), sizeof(quat) + sizeof(mat4));
+    report("quat to_matrices", time_ns([&] { to_matrices(a.data(), w.data(), m.data(), elements); }), sizeof(quat) + sizeof(vec3) + sizeof(mat4));
+}
+
+void bench_affine(std::mt19937& rng) {
+    std::vector<quat> q = random_quats(rng, elements);
+    std::vector<vec3> t = random_vectors<vec3>(rng);
+    std::vector<affine3> a(elements), out(elements);
+    std::vector<mat4> m(elements, mat4(uninitialized)), mout(elements, mat4(uninitialized));
+    for (int i = 0; i < elements; ++i) {
+        a[i] = affine3(t[i], q[i]);
+        m[i] = a[i].to_mat4();
+    }
+    affine3 parent(vec3{ 1.0f, 2.0f, 3.0f }, quat::axis_angle(vec3{ 0.0f, 1.0f, 0.0f }, 0.5f));
+    mat4 parent4 = parent.to_mat4();
+
+    report("mat4 * mat4 world", time_ns([&] { for (int i = 0; i < elements; ++i) mout[i] = parent4 * m[i]; }), 2 * sizeof(mat4));
+    report("affine3 * affine3", time_ns([&] { for (int i = 0; i < elements; ++i) out[i] = parent * a[i]; }), 2 * sizeof(affine3));
+    report("mat4 inverse", time_ns([&] { for (int i = 0; i < elements; ++i) mout[i] = inverse(m[i]); }), 2 * sizeof(mat4));
+    report("affine3 inverse", time_ns([&] { for (int i = 0; i < elements; ++i) out[i] = a[i].inverse(); }), 2 * sizeof(affine3));
+    report("affine3 inverse_rigid", time_ns([&] { for (int i = 0; i < elements; ++i) out[i] = a[i].inverse_rigid(); }), 2 * sizeof(affine3));
+    report("affine3 normal_matrix", time_ns([&] { float s = 0; for (int i = 0; i < elements; ++i) s += a[i].normal_matrix()(0, 0); sink += s; }), sizeof(affine3));
+}
+
+void bench_bounds(std::mt19937& rng) {
+    const int count = 100000;
+    std::uniform_real_distribution<float> position(-100.0f, 100.0f), size(0.1f, 2.0f);
+    std::vector<aabb> boxes(count);
+    std::vector<sphere> spheres(count);
+    for (int i = 0; i < count; ++i) {
+        vec3 c{ position(rng), position(rng), position(rng) }, e{ size(rng), size(rng), size(rng) };
+        boxes[i] = aabb{ c - e, c + e };
+        spheres[i] = sphere{ c, e.x };
+    }
+    std::vector<int> visible(count);
+    frustum f = frustum::from_matrix(perspective(pi / 3, 16.0f / 9.0f, 1.0f, 100.0f) * look_at(vec3{ 0.0f, 0.0f, -50.0f }, vec3(0.0f), vec3{ 0.0f, 1.0f, 0.0f }));
+    ray r{ vec3{ -100.0f, 0.0f, 0.0f }, vec3{ 1.0f, 0.01f, 0.02f }.normalized() };
+    int n = 0;
+
+    // Reported per volume, over the 100k volumes.
+    report("frustum aabb loop", time_ns([&] {
+        n = 0;
+        for (int i = 0; i < count; ++i) {
+            visible[n] = i;
+            n += f.intersects(boxes[i]);
+        }
+    }), sizeof(aabb) + sizeof(int), count);
+    report("cull_boxes", time_ns([&] { n = cull_boxes(f, boxes.data(), count, visible.data()); }), sizeof(aabb) + sizeof(int), count);
+    report("frustum sphere loop", time_ns([&] {
+        n = 0;
+        for (int i = 0; i < count; ++i) {
+            visible[n] = i;
+            n += f.intersects(spheres[i]);
+        }
+    }), sizeof(sphere) + sizeof(int), count);
+    report("cull_spheres", time_ns([&] { n = cull_spheres(f, spheres.data(), count, visible.data()); }), sizeof(sphere) + sizeof(int), count);
+    report("ray aabb loop", time_ns([&] {
+        float t;
+        n = 0;
+        for (int i = 0; i < count; ++i) {
+            visible[n] = i;
+            n += r.intersects(boxes[i], t);
+        }
+    }), sizeof(aabb) + sizeof(int), count);
+    report("raycast_boxes", time_ns([&] { n = raycast_boxes(r, boxes.data(), count, visible.data()); }), sizeof(aabb) + sizeof(int), count);
+    sink += float(n);
+}
+
+void bench_trig(std::mt19937& rng) {
+    std::vector<float> x(elements), y(elements), out(elements), out2(elements);
+    std::uniform_real_distribution<float> angle(-100.0f, 100.0f);
+    for (int i = 0; i < elements; ++i) {
+        x[i] = angle(rng);
+        y[i] = angle(rng);
+    }
+
+    report("wrapAngle", time_ns([&] { for (int i = 0; i < elements; ++i) out[i] = wrapAngle(x[i]); }), 2 * sizeof(float));
+    report("fast::wrap_angle batch", time_ns([&] { fast::wrap_angle(x.data(), out.data(), elements); }), 2 * sizeof(float));
+    report("std::sin", time_ns([&] { for (int i = 0; i < elements; ++i) out[i] = std::sin(x[i]); }), 2 * sizeof(float));
+    report("fast::sin", time_ns([&] { for (int i = 0; i < elements; ++i) out[i] = fast::sin(x[i]); }), 2 * sizeof(float));
+    report("fast::sin batch", time_ns([&] { fast::sin(x.data(), out.data(), elements); }), 2 * sizeof(float));
+    report("fast::sincos batch", time_ns([&] { fast::sincos(x.data(), out.data(), out2.data(), elements); }), 3 * sizeof(float));
+    report("std::atan2", time_ns([&] { for (int i = 0; i < elements; ++i) out[i] = std::atan2(y[i], x[i]); }), 3 * sizeof(float));
+    report("fast::atan2", time_ns([&] { for (int i = 0; i < elements; ++i) out[i] = fast::atan2(y[i], x[i]); }), 3 * sizeof(float));
+    report("fast::atan2 batch", time_ns([&] { fast::atan2(y.data(), x.data(), out.data(), elements); }), 3 * sizeof(float));
+    for (float& f : y) {
+        f = std::fabs(f) + 1.0f;
+    }
+    report("1 / std::sqrt", time_ns([&] { for (int i = 0; i < elements; ++i) out[i] = 1.0f / std::sqrt(y[i]); }), 2 * sizeof(float));
+    report("fast::rsqrt batch", time_ns([&] { fast::rsqrt(y.data(), out.data(), elements); }), 2 * sizeof(float));
+}
+
+// A scene spanning 1e9 units: objects scattered at every scale from 1 to 1e9 units
+// out, and a camera parked right next to one of the most distant ones. Reports the
+// worst render space error of the nearby objects for plain float world positions
+// against double positions rebased on the camera.
+void bench_large_world(std::mt19937& rng) {
+    const int count = 100000;
+    std::uniform_real_distribution<double> exponent(0.0, 9.0), direction(-1.0, 1.0), local(-50.0, 50.0);
+    std::vector<vec3d> positions(count);
+    for (vec3d& p : positions) {
+        p = vec3d{ direction(rng), direction(rng), direction(rng) } * std::pow(10.0, exponent(rng));
+    }
+    vec3d eye = vec3d{ 0.6, -0.8, 0.0 } * 1e9;
+    for (int i = 0; i < 1000; ++i) {
+        positions[i] = eye + vec3d{ local(rng), local(rng), local(rng) };
+    }
+
+    std::vector<vec3> offsets(count);
+    double ns = time_ns([&] { relative_to(eye, positions.data(), offsets.data(), count); });
+    report("relative_to", ns, sizeof(vec3d) + sizeof(vec3), count);
+
+    vec3 eye_f = to_vec3(eye);
+    double float_error = 0.0, rebased_error = 0.0;
+    for (int i = 0; i < 1000; ++i) {
+        vec3d exact = positions[i] - eye;
+        vec3 naive = to_vec3(positions[i]) - eye_f;
+        vec3 rebased = relative_to(positions[i], eye);
+        for (int j = 0; j < 3; ++j) {
+            float_error = std::max(float_error, std::fabs(naive.data[j] - exact.data[j]));
+            rebased_error = std::max(rebased_error, std::fabs(rebased.data[j] - exact.data[j]));
+        }
+    }
+    report_metric("1e9 error float", float_error);
+    report_metric("1e9 error relative", rebased_error);
+}
+
+int main(int argc, char** argv) {
+    const char* json = nullptr;
+    for (int i = 1; i < argc; ++i) {
+        if (strcmp(argv[i], "--json") == 0 && i + 1 < argc) {
+            json = argv[++i];
+        } else {
+            fprintf(stderr, "usage: %s [--json <file>|-]\n", argv[0]);
+            return 2;
+        }
+    }
+    quiet = json && strcmp(json, "-") == 0;
+
+    std::mt19937 rng(1234);
+
+    if (!quiet) {
+        printf("math_bench: %d elements, %d repeats, simd=%s\n", elements, repeats, simd::name);
+    }
+
+    bench_vectors<vec3>("vec3", rng);
+    bench_cross(rng);
+    bench_vectors<vec4>("vec4", rng);
+    bench_matrices(rng);
+    bench_transforms(rng);
+    bench_streams(rng);
+    bench_soa(rng);
+    bench_lerp(rng);
+    bench_quats(rng);
+    bench_affine(rng);
+    bench_bounds(rng);
+    bench_trig(rng);
+    bench_large_world(rng);
+
+    if (json) {
+        FILE* f = quiet ? stdout : fopen(json, "w");
+        if (!f) {
+            fprintf(stderr, "cannot write %s\n", json);
+            return 1;
+        }
+        write_json(f);
+        if (f != stdout) {
+            fclose(f);
+        }
+    }
+
+    return sink == 1.0f ? 1 : 0;
+}
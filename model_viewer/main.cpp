@@ -8,6 +8,9 @@
 #include <chaiscript/chaiscript.hpp>
 #include <maths.hpp>
 #include <rendering.hpp>
+#include <render_queue.hpp>
+#include <frame_pipeline.hpp>
+#include <fixed_timestep.hpp>
 #include <io.hpp>
 #include <nodes/camera.hpp>
 #include <nodes/skybox.hpp>
@@ -15,19 +18,42 @@
 #define WINDOW_TITLE        "Model Viewer"
 
 
+/* A model placed in the large world at a double precision position. Like every
+ * node, its transform and bounds are in the frame of the camera's origin: place()
+ * rebases the position onto the origin, and has to run again whenever it moves.
+ */
 class model : public node {
     mesh& m;
     gl::program& s;
 public:
-    model(mesh& m, gl::program& s) : m(m), s(s) { }
+    vec3d position;
+
+    model(scene& graph, mesh& m, gl::program& s, const vec3d& position) : node(graph), m(m), s(s), position(position) { }
 
-    void draw(render_state rs) {
-        s.use();
-        s["transform"] = rs.projection * rs.view;
-        s["world"] = rs.world;
-        m.draw(s["albedo"], s["roughness"], s["metalness"]);
+    void place(const vec3d& origin) {
+        set_local(affine3(relative_to(position, origin), quat()));
+    }
 
-        node::draw(rs);
+    bool draw_node(const render_state& rs) {
+        mat4 world = world_matrix(rs);
+        vec3 light = rs.relative(position + vec3d{ 2.0, 0.5, -2.0 }); /* Lights are large-world points, beside the model. */
+        if (rs.queue) {
+            /* Sorted with everything else, drawn once the traversal is done. */
+            rs.queue->prepare(s, [this, light] {
+                s["camera_position"] = vec3(0.0f); /* Rendering is camera relative. */
+                s["light_position"] = light;
+            });
+            rs.queue->submit(s, m, world);
+        } else {
+            s.use();
+            s["transform"] = rs.projection * rs.view;
+            s["world"] = world;
+            s["normal_matrix"] = affine3(world).normal_matrix();
+            s["camera_position"] = vec3(0.0f);
+            s["light_position"] = light;
+            m.draw(s["albedo"], s["roughness"], s["metalness"]);
+        }
+        return true;
     }
 };
 
@@ -36,6 +62,7 @@ public:
  */
 struct game_options {
     int width, height; /* The current operating resolution. */
+    double tick_rate; /* Simulation ticks per second, however fast frames are drawn. */
 };
 
 /* The main entry point into the game.
@@ -49,7 +76,8 @@ int main(int argc, char** argv) {
 
     game_options options = {
         1280,
-        720
+        720,
+        60.0
     };
 
     /* TODO: Parse the command line and configuration file options. */
@@ -77,15 +105,16 @@ int main(int argc, char** argv) {
     glEnable(GL_DEPTH_TEST);
 
 
-    node root;
-    camera viewport;
+    scene graph; /* Outlives every node in it. */
+    node root(graph);
+    camera viewport(graph);
     root.add(&viewport);
 
     viewport.position = { -5.0f, 3.0f, -3.0f };
     viewport.direction = { 5.0f, 1.0f, 3.0f };
     viewport.up = { 0.0f, 1.0f, 0.0f };
 
-    skybox sky;
+    skybox sky(graph);
     sky.load_cube_map("front.bmp", "back.bmp", "top.bmp", "bottom.bmp", "left.bmp", "right.bmp");
     sky.load_shader("shaders/skybox.vert", "shaders/skybox.frag");
     viewport.add(&sky);
@@ -99,13 +128,50 @@ int main(int argc, char** argv) {
     fragment.set_source(file::read("shaders/object.frag"));
     s.build(vertex, fragment);
 
-    model object(m, s);
-    viewport.add(&object);
+    /* Two models 1e9 units apart. The camera orbits one of them, and F moves its
+     * origin across to the other.
+     */
+    model home(graph, m, s, vec3d(0.0)), distant(graph, m, s, vec3d{ 6e8, -8e8, 1e3 });
+    for (model* object : { &home, &distant }) {
+        object->place(viewport.origin);
+        object->set_bounds(m.bounds);
+        viewport.add(object);
+    }
+
+    job_system jobs;
 
     float time = 0;
 
+    /* One tick of the viewer, and everything it moved brought up to date. */
+    auto simulate = [&](float dt) {
+        /* TODO: Update the game logic here. */
+        graph.update_sleep(dt); /* Wakes sleeping nodes that are due, before the update skips the rest. */
+        root.update_parallel(dt, jobs);
+        graph.transforms().update(); /* Only recomputes the world transforms of nodes that moved. */
+        graph.update_space(); /* Keeps the bounds used for culling with the nodes. */
+
+        /* After the update, which keeps the camera's pose before it to draw between ticks from. */
+        time += 0.6f * dt;
+        viewport.position.x = 10 * cos(time);
+        viewport.position.z = 10 * sin(time);
+        viewport.direction = -viewport.position;
+    };
+
+    /* Up to 5 ticks catch up after a slow frame; a longer backlog is dropped. */
+    fixed_timestep timestep(options.tick_rate, 5);
+
+    /* Pipelined, the next frame is simulated on a job while this thread renders the
+     * last one from the render queue it was extracted into.
+     */
+    frame_pipeline<render_queue> pipeline(jobs);
+    bool pipelined = false;
+    bool away = false;
+
     running = true;
     while (running) {
+        pipeline.finish(); /* The scene is this thread's again until the next start(). */
+        jobs.run_main_jobs(); /* GL work scheduled by the update. */
+
         while (SDL_PollEvent(&event)) {
             switch (event.type) {
             case SDL_QUIT:
@@ -119,24 +185,78 @@ int main(int argc, char** argv) {
                 }
                 break;
 
+            case SDL_KEYDOWN:
+                if (event.key.keysym.sym == SDLK_c) { /* A/B the cost of frustum culling. */
+                    viewport.culling = !viewport.culling;
+                    printf("culling %s; last frame drew %d, culled %d of %d tested\n", viewport.culling ? "on" : "off",
+                           viewport.stats.drawn, viewport.stats.culled, viewport.stats.tested);
+                }
+                if (event.key.keysym.sym == SDLK_q) { /* A/B the sorted render queue. */
+                    const render_queue::stats& q = (pipelined ? pipeline.front() : viewport.queue).last_frame();
+                    viewport.sorting = !viewport.sorting;
+                    printf("render queue %s; last frame %d draws, %d/%d/%d program/array/material changes, %d/%d/%d unsorted\n",
+                           viewport.sorting ? "on" : "off", q.draws, q.programs, q.arrays, q.materials,
+                           q.unsorted_programs, q.unsorted_arrays, q.unsorted_materials);
+                }
+                if (event.key.keysym.sym == SDLK_z) { /* How much of the scene is asleep. */
+                    scene::sleep_stats s = graph.count_sleep();
+                    printf("%d of %d nodes active, %d asleep; woken by %d events, %d timers, %d proximity\n", s.active, s.total, s.asleep,
+                           s.woken[sleep_schedule::event], s.woken[sleep_schedule::timer], s.woken[sleep_schedule::proximity]);
+                }
+                if (event.key.keysym.sym == SDLK_f) { /* Stress test: the same scene 1e9 units out, which should look no different. */
+                    away = !away;
+                    model& beside = away ? distant : home;
+                    viewport.origin = beside.position;
+                    home.place(viewport.origin);
+                    distant.place(viewport.origin);
+
+                    /* The model beside the camera should look no different. Float world
+                     * positions are 64 units apart out there, so they would lose its offset
+                     * from the eye altogether and it would jump about as the camera moves.
+                     */
+                    vec3d exact = beside.position - viewport.eye();
+                    vec3 naive = to_vec3(beside.position) - to_vec3(viewport.eye()), rebased = relative_to(beside.position, viewport.eye());
+                    double naive_error = 0.0, rebased_error = 0.0;
+                    for (int k = 0; k < 3; ++k) {
+                        naive_error = std::max(naive_error, std::fabs(naive.data[k] - exact.data[k]));
+                        rebased_error = std::max(rebased_error, std::fabs(rebased.data[k] - exact.data[k]));
+                    }
+                    printf("camera at the model %s; its offset from the eye is %g off in float world positions, %g rebased\n",
+                           away ? "1e9 units from the origin" : "at the origin", naive_error, rebased_error);
+                }
+                if (event.key.keysym.sym == SDLK_p) { /* A/B overlapping simulation and rendering. */
+                    pipelined = !pipelined;
+                    printf("pipelining %s\n", pipelined ? "on" : "off");
+                }
+                break;
+
             default:
                 break;
             }
         }
 
-        time += 0.01f;
-        viewport.position.x = 10 * cos(time);
-        viewport.position.z = 10 * sin(time);
-        viewport.direction = -viewport.position;
-
-        s.use();
-        s["camera_position"] = viewport.position;
-
-        /* TODO: Update the game logic here. */
-        root.update(1.0f);
+        /* Frames land between ticks, so they are drawn rewound towards the tick before. */
+        int ticks = timestep.advance();
+        float dt = timestep.dt(), rewind = 1.0f - timestep.alpha();
+        if (pipelined) {
+            pipeline.start([&, ticks, dt, rewind](render_queue& next) {
+                for (int i = 0; i < ticks; ++i) {
+                    simulate(dt);
+                }
+                viewport.extract(next, rewind);
+            });
+            camera::render(pipeline.front());
+        } else {
+            for (int i = 0; i < ticks; ++i) {
+                simulate(dt);
+            }
+            jobs.run_main_jobs();
 
-        /* TODO: Render the game to the screen here. */
-        root.draw();
+            /* TODO: Render the game to the screen here. */
+            node::render_state rs = node::render_state();
+            rs.rewind = rewind;
+            root.draw(rs);
+        }
 
 
         SDL_GL_SwapWindow(window);
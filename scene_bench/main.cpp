@@ -0,0 +1,905 @@
+#include <cstdio>
+#include <cstring>
+#include <chrono>
+#include <memory>
+#include <vector>
+#include <random>
+#include <algorithm>
+#include <functional>
+#include <string>
+#include <node.hpp>
+#include <ecs.hpp>
+#include <node_pool.hpp>
+#include <radix_sort.hpp>
+#include <render_queue.hpp>
+#include <frame_pipeline.hpp>
+#include <fixed_timestep.hpp>
+
+/* Headless benchmarks for the scene graph. Needs no window or GL context.
+ * Thread scaling is measured from 1 up to the number of hardware threads.
+ */
+
+static const int nodes = 100000;
+static const int repeats = 20;
+
+static float sink = 0.0f;
+static int failures = 0; // results that came out wrong
+
+template <class Fn>
+double time_ns(Fn fn) {
+    fn(); // warm the caches
+    auto start = std::chrono::high_resolution_clock::now();
+    for (int r = 0; r < repeats; ++r) {
+        fn();
+    }
+    auto end = std::chrono::high_resolution_clock::now();
+    return std::chrono::duration<double, std::nano>(end - start).count() / repeats;
+}
+
+void report(const char* name, double ns, int count = nodes) {
+    printf("%-32s %10.3f ms %8.3f ns/node\n", name, ns * 1e-6, ns / count);
+}
+
+/* The traversal the hierarchy replaces: each node finds its world transform from
+ * its parent's in a virtual update, recursing through the child pointers.
+ */
+class recursive_node : public node {
+public:
+    using node::node;
+
+    affine3 transform, world_transform;
+
+    void update(float dt) override {
+        recursive_node* p = static_cast<recursive_node*>(get_parent());
+        world_transform = p ? p->world_transform * transform : transform;
+        node::update(dt);
+    }
+};
+
+affine3 random_transform(std::mt19937& rng) {
+    std::uniform_real_distribution<float> d(-1.0f, 1.0f);
+    vec3 axis = vec3{ d(rng), d(rng), d(rng) }.normalized();
+    return affine3(vec3{ d(rng), d(rng), d(rng) } * 10.0f, quat::axis_angle(axis, d(rng) * pi), vec3(1.0f));
+}
+
+/* A random tree of 100k nodes: every node hangs under a random earlier one. The
+ * nodes are allocated in shuffled order, so neighbours in the tree are scattered
+ * around the heap as they are in a scene built up over time.
+ */
+void bench_hierarchy(std::mt19937& rng) {
+    scene graph;
+    std::vector<int> order(nodes);
+    for (int i = 0; i < nodes; ++i) {
+        order[i] = i;
+    }
+    std::shuffle(order.begin() + 1, order.end(), rng);
+
+    std::vector<std::unique_ptr<recursive_node>> tree(nodes);
+    for (int i : order) {
+        tree[i].reset(new recursive_node(graph));
+    }
+    for (int i = 0; i < nodes; ++i) {
+        tree[i]->transform = random_transform(rng);
+        tree[i]->set_local(tree[i]->transform);
+        if (i > 0) {
+            tree[std::uniform_int_distribution<int>(0, i - 1)(rng)]->add(tree[i].get());
+        }
+    }
+
+    transform_hierarchy& h = graph.transforms();
+    auto start = std::chrono::high_resolution_clock::now();
+    h.update();
+    auto end = std::chrono::high_resolution_clock::now();
+    report("hierarchy first update (sort)", std::chrono::duration<double, std::nano>(end - start).count());
+
+    // Every node moving, as when the whole tree is animated.
+    double recursive = time_ns([&] { tree[0]->update(0.0f); });
+    double flat = time_ns([&] { tree[0]->set_local(tree[0]->transform); h.update(); });
+    report("recursive node::update", recursive);
+    report("transform_hierarchy::update", flat);
+    printf("%-32s %10.2fx\n", "speedup", recursive / flat);
+
+    // Only some nodes moving; the rest keep their cached world transforms.
+    std::vector<recursive_node*> movers;
+    for (int i = 0; i < nodes; i += 100) {
+        movers.push_back(tree[std::uniform_int_distribution<int>(nodes / 2, nodes - 1)(rng)].get());
+    }
+    transform_hierarchy::stats stats{ 0, 0 };
+    double some = time_ns([&] {
+        for (recursive_node* n : movers) {
+            n->set_local(n->transform);
+        }
+        stats = h.update();
+    });
+    report("update, 1% of nodes moving", some);
+    printf("%-32s %10d of %d\n", "world transforms recomputed", stats.recomputed, stats.entries);
+    report("update, nothing moving", time_ns([&] { stats = h.update(); }));
+    printf("%-32s %10d of %d\n", "world transforms recomputed", stats.recomputed, stats.entries);
+
+    float error = 0.0f;
+    for (auto& n : tree) {
+        for (int i = 0; i < 12; ++i) {
+            error = std::max(error, std::fabs(n->world().data[i] - n->world_transform.data[i]));
+        }
+    }
+    printf("%-32s %10.3g\n", "max difference", error);
+    sink += error;
+}
+
+/* A synthetic per node workload for the job system: every node integrates its
+ * own spin and writes its local transform, a few hundred flops each.
+ */
+class spinning_node : public node {
+public:
+    using node::node;
+
+    quat orientation;
+    vec3 position, spin;
+
+    void update(float dt) override {
+        for (int i = 0; i < 8; ++i) {
+            integrate(&orientation, &spin, 1, dt / 8);
+        }
+        set_local(affine3(position, orientation));
+        node::update(dt);
+    }
+};
+
+void bench_parallel_update(std::mt19937& rng) {
+    scene graph;
+    std::uniform_real_distribution<float> d(-1.0f, 1.0f);
+    std::vector<std::unique_ptr<spinning_node>> tree(nodes);
+    for (int i = 0; i < nodes; ++i) {
+        tree[i].reset(new spinning_node(graph));
+        tree[i]->position = vec3{ d(rng), d(rng), d(rng) } * 10.0f;
+        tree[i]->spin = vec3{ d(rng), d(rng), d(rng) };
+        if (i > 0) {
+            tree[std::uniform_int_distribution<int>(0, i - 1)(rng)]->add(tree[i].get());
+        }
+    }
+
+    double serial = time_ns([&] { tree[0]->update(0.01f); });
+    report("node::update, 1 thread", serial);
+
+    int threads = std::max(1u, std::thread::hardware_concurrency());
+    for (int t = 1; t <= threads; ++t) {
+        job_system jobs(t - 1);
+        double ns = time_ns([&] { tree[0]->update_parallel(0.01f, jobs); });
+        char name[64];
+        snprintf(name, sizeof(name), "update_parallel, %d thread%s", t, t > 1 ? "s" : "");
+        report(name, ns);
+        printf("%-32s %10.2fx\n", "speedup", serial / ns);
+    }
+
+    // The same nodes as 1000 small groups: only the root has descendants enough
+    // to fan out, and each group runs serially inside one job.
+    node groups(graph);
+    for (int i = 1; i < nodes; ++i) {
+        tree[i]->get_parent()->remove(tree[i].get());
+    }
+    for (int i = 1; i < nodes; ++i) {
+        (i % 100 == 1 ? &groups : tree[(i - 1) / 100 * 100 + 1].get())->add(tree[i].get());
+    }
+    double grouped = time_ns([&] { groups.update(0.01f); });
+    report("small groups, 1 thread", grouped);
+    for (int t = 2; t <= threads; ++t) {
+        job_system jobs(t - 1);
+        double ns = time_ns([&] { groups.update_parallel(0.01f, jobs); });
+        char name[64];
+        snprintf(name, sizeof(name), "small groups, %d threads", t);
+        report(name, ns);
+        printf("%-32s %10.2fx\n", "speedup", grouped / ns);
+    }
+    sink += graph.transforms().update().recomputed;
+}
+
+/* Frames of a simulation and a stand-in renderer, back to back and through a
+ * frame_pipeline. The simulation is the spinning update of 100k nodes; it
+ * extracts their world matrices as the snapshot the renderer reads.
+ */
+void bench_pipeline(std::mt19937& rng) {
+    scene graph;
+    std::uniform_real_distribution<float> d(-1.0f, 1.0f);
+    node root(graph);
+    std::vector<std::unique_ptr<spinning_node>> tree(nodes);
+    for (int i = 0; i < nodes; ++i) {
+        tree[i].reset(new spinning_node(graph));
+        tree[i]->position = vec3{ d(rng), d(rng), d(rng) } * 10.0f;
+        tree[i]->spin = vec3{ d(rng), d(rng), d(rng) };
+        root.add(tree[i].get());
+    }
+
+    auto simulate = [&] {
+        root.update(0.01f);
+        graph.transforms().update();
+    };
+    auto extract = [&](std::vector<mat4>& snapshot) {
+        snapshot.resize(nodes);
+        for (int i = 0; i < nodes; ++i) {
+            snapshot[i] = tree[i]->world().to_mat4();
+        }
+    };
+    auto render = [](const std::vector<mat4>& snapshot) {
+        float sum = 0.0f;
+        for (int r = 0; r < 32; ++r) {
+            for (const mat4& m : snapshot) {
+                sum += (m * m).data[r & 15];
+            }
+        }
+        sink += sum;
+    };
+
+    std::vector<mat4> snapshot;
+    double serial = time_ns([&] {
+        simulate();
+        extract(snapshot);
+        render(snapshot);
+    });
+
+    job_system jobs(1);
+    frame_pipeline<std::vector<mat4>> pipeline(jobs);
+    double pipelined = time_ns([&] {
+        pipeline.finish();
+        pipeline.start([&](std::vector<mat4>& next) {
+            simulate();
+            extract(next);
+        });
+        render(pipeline.front());
+    });
+    pipeline.finish();
+
+    double sim = time_ns([&] { simulate(); extract(snapshot); });
+    double draw = time_ns([&] { render(snapshot); });
+    report("frame, simulate then render", serial);
+    report("frame, pipelined", pipelined);
+    report("simulate and extract alone", sim);
+    report("render alone", draw);
+    printf("%-32s %10.2fx of %u hardware threads\n", "speedup", serial / pipelined, std::thread::hardware_concurrency());
+}
+
+/* A universe that is mostly parked: 1000 ships of 100 spinning parts, 90% of the
+ * ships asleep. Each frame a few ships wake and as many doze off.
+ */
+void bench_sleep(std::mt19937& rng) {
+    scene graph;
+    std::uniform_real_distribution<float> d(-1.0f, 1.0f);
+    node root(graph);
+    std::vector<std::unique_ptr<spinning_node>> tree(nodes);
+    std::vector<spinning_node*> ships;
+    for (int i = 0; i < nodes; ++i) {
+        tree[i].reset(new spinning_node(graph));
+        tree[i]->position = vec3{ d(rng), d(rng), d(rng) } * 10.0f;
+        tree[i]->spin = vec3{ d(rng), d(rng), d(rng) };
+        if (i % 100 == 0) {
+            ships.push_back(tree[i].get());
+            root.add(tree[i].get());
+        } else {
+            ships.back()->add(tree[i].get());
+        }
+    }
+
+    double all = time_ns([&] { root.update(0.01f); });
+    for (size_t i = 0; i < ships.size(); ++i) {
+        if (i % 10) {
+            ships[i]->sleep();
+        }
+    }
+    graph.update_sleep(0.01f);
+    double parked = time_ns([&] { root.update(0.01f); });
+
+    std::uniform_int_distribution<int> pick(0, (int)ships.size() - 1);
+    double changing = time_ns([&] {
+        for (int i = 0; i < 10; ++i) {
+            spinning_node* s = ships[pick(rng)];
+            s->asleep() ? s->wake() : s->sleep();
+        }
+        graph.update_sleep(0.01f);
+    });
+
+    report("update, all awake", all);
+    report("update, 90% asleep", parked);
+    printf("%-32s %10.2fx\n", "speedup", all / parked);
+    report("update_sleep, 10 changes", changing, 10);
+    scene::sleep_stats s = graph.count_sleep();
+    printf("%-32s %10d of %d, %d asleep\n", "nodes active", s.active, s.total, s.asleep);
+    printf("%-32s %10d events, %d timers, %d proximity\n", "woken by", s.woken[sleep_schedule::event], s.woken[sleep_schedule::timer],
+           s.woken[sleep_schedule::proximity]);
+
+    // A ship asleep on a timer, put back to sleep for good and then for longer:
+    // neither may wake it early, and its timer must still fire on time.
+    spinning_node* ship = ships[0];
+    ship->wake();
+    ship->sleep_for(1.0f);
+    graph.update_sleep(0.0f);
+    ship->sleep();
+    graph.update_sleep(0.5f);
+    bool resleep = ship->asleep();
+    ship->sleep_for(0.2f);
+    graph.update_sleep(0.1f);
+    resleep = resleep && ship->asleep();
+    graph.update_sleep(0.15f);
+    resleep = resleep && !ship->asleep() && graph.count_sleep().woken[sleep_schedule::timer] == s.woken[sleep_schedule::timer] + 1;
+    if (!resleep) {
+        fprintf(stderr, "sleep_schedule: sleeping a node already asleep on a timer woke it at the wrong time\n");
+        ++failures;
+    }
+}
+
+/* Many small independent objects, as node subclasses and as entities: each one
+ * drifts and tumbles and needs a transform to be drawn with.
+ */
+class drifting_node : public node {
+public:
+    using node::node;
+
+    vec3 position, velocity, spin;
+    quat orientation;
+
+    void update(float dt) override {
+        position += velocity * dt;
+        integrate(&orientation, &spin, 1, dt);
+        set_local(affine3(position, orientation));
+        node::update(dt);
+    }
+};
+
+struct body {
+    vec3 position, velocity;
+};
+
+struct angular_velocity {
+    vec3 value;
+};
+
+void bench_entities(std::mt19937& rng) {
+    scene graph;
+    std::uniform_real_distribution<float> d(-1.0f, 1.0f);
+    const float dt = 0.01f;
+
+    node root(graph);
+    std::vector<std::unique_ptr<drifting_node>> objects(nodes);
+    for (auto& n : objects) {
+        n.reset(new drifting_node(graph));
+        n->position = vec3{ d(rng), d(rng), d(rng) } * 100.0f;
+        n->velocity = vec3{ d(rng), d(rng), d(rng) };
+        n->spin = vec3{ d(rng), d(rng), d(rng) };
+        root.add(n.get());
+    }
+    transform_hierarchy& h = graph.transforms();
+    double per_node = time_ns([&] { root.update(dt); h.update(); });
+
+    ecs::world w;
+    std::vector<ecs::entity> entities;
+    for (int i = 0; i < nodes; ++i) {
+        body b{ vec3{ d(rng), d(rng), d(rng) } * 100.0f, vec3{ d(rng), d(rng), d(rng) } };
+        entities.push_back(w.create(b, quat(), angular_velocity{ vec3{ d(rng), d(rng), d(rng) } }, affine3()));
+    }
+    auto start = std::chrono::high_resolution_clock::now();
+    w.sync();
+    auto end = std::chrono::high_resolution_clock::now();
+
+    ecs::query<body> moving(w);
+    ecs::query<quat, const angular_velocity> spinning(w);
+    ecs::query<const body, const quat, affine3> placed(w);
+    w.add_system([&](ecs::world&, float dt) {
+        moving.each([dt](body& b) { b.position += b.velocity * dt; });
+    });
+    w.add_system([&](ecs::world&, float dt) {
+        spinning.each([dt](quat& q, const angular_velocity& v) { integrate(&q, &v.value, 1, dt); });
+    });
+    w.add_system([&](ecs::world&, float) {
+        placed.each([](const body& b, const quat& q, affine3& t) { t = affine3(b.position, q); });
+    });
+    double ecs_update = time_ns([&] { w.update(dt); });
+
+    report("node per object, update", per_node);
+    report("ecs::world::update", ecs_update);
+    printf("%-32s %10.2fx\n", "speedup", per_node / ecs_update);
+    report("ecs::world::sync, creating all", std::chrono::duration<double, std::nano>(end - start).count());
+
+    // 1% of the entities replaced every frame, as projectiles come and go.
+    std::uniform_int_distribution<int> pick(0, nodes - 1);
+    report("update, 1% destroyed and created", time_ns([&] {
+        for (int i = 0; i < nodes / 100; ++i) {
+            ecs::entity& e = entities[pick(rng)];
+            w.destroy(e);
+            e = w.create(body{ vec3(0.0f), vec3(1.0f) }, quat(), angular_velocity{ vec3(1.0f) }, affine3());
+        }
+        w.update(dt);
+    }));
+    printf("%-32s %10d in %d chunks of %d\n", "entities", w.size(), w.types()[0]->chunk_count(), w.types()[0]->chunk_capacity());
+
+    job_system jobs;
+    double parallel = time_ns([&] {
+        placed.each_chunk(jobs, [dt](int count, const ecs::entity*, const body* b, const quat* q, affine3* t) {
+            for (int i = 0; i < count; ++i) {
+                t[i] = affine3(b[i].position + b[i].velocity * dt, q[i]);
+            }
+        });
+    });
+    char name[64];
+    snprintf(name, sizeof(name), "each_chunk, %d thread%s", jobs.workers() + 1, jobs.workers() ? "s" : "");
+    report(name, parallel);
+
+    // Every transform, as the writes from a job can be lost outright (see
+    // archetype::chunk).
+    float error = 0.0f;
+    for (ecs::entity e : entities) {
+        affine3 expected(w.get<body>(e)->position + w.get<body>(e)->velocity * dt, *w.get<quat>(e));
+        for (int k = 0; k < 12; ++k) {
+            error = std::max(error, std::fabs(w.get<affine3>(e)->data[k] - expected.data[k]));
+        }
+    }
+    printf("%-32s %10.3g\n", "max difference", error);
+    if (!(error < 1e-5f)) {
+        fprintf(stderr, "each_chunk: writes lost or wrong, max difference %g\n", error);
+        ++failures;
+    }
+    sink += error;
+}
+
+/* A sector node with 50k children spawned and then all despawned in random order,
+ * against removing them from the child list by search and erase.
+ */
+void bench_despawn(std::mt19937& rng) {
+    scene graph;
+    const int count = 50000;
+    node sector(graph);
+    node_pool<spinning_node> pool;
+    std::vector<node_pool<spinning_node>::handle> handles;
+
+    auto start = std::chrono::high_resolution_clock::now();
+    for (int i = 0; i < count; ++i) {
+        handles.push_back(pool.create(&sector, graph));
+    }
+    pool.apply();
+    auto end = std::chrono::high_resolution_clock::now();
+    report("node_pool, spawn 50k children", std::chrono::duration<double, std::nano>(end - start).count(), count);
+
+    std::shuffle(handles.begin(), handles.end(), rng);
+    std::vector<node*> order;
+    for (auto h : handles) {
+        order.push_back(pool.get(h));
+    }
+    std::vector<node*> children = order;
+    std::shuffle(children.begin(), children.end(), rng);
+
+    start = std::chrono::high_resolution_clock::now();
+    for (node* n : order) {
+        children.erase(std::remove(children.begin(), children.end(), n));
+    }
+    end = std::chrono::high_resolution_clock::now();
+    report("search and erase, 50k children", std::chrono::duration<double, std::nano>(end - start).count(), count);
+
+    start = std::chrono::high_resolution_clock::now();
+    for (auto h : handles) {
+        pool.destroy(h);
+    }
+    pool.apply();
+    end = std::chrono::high_resolution_clock::now();
+    report("node_pool, despawn 50k children", std::chrono::duration<double, std::nano>(end - start).count(), count);
+
+    int stale = 0;
+    for (auto h : handles) {
+        stale += pool.get(h) == nullptr;
+    }
+    printf("%-32s %10d of %d, %d children left\n", "stale handles", stale, count, sector.child_count());
+    sink += stale;
+}
+
+class turret : public node {
+public:
+    using node::node;
+};
+
+/* A scene-wide search with node::find alone: a std::function visitor recursing
+ * through every level of the tree.
+ */
+void find_all(node* n, const std::function<bool(node*)>& match, std::vector<node*>& found) {
+    std::function<bool(node*)> visit = [&](node* c) {
+        if (match(c)) {
+            found.push_back(c);
+        }
+        find_all(c, match, found);
+        return false;
+    };
+    n->find(visit);
+}
+
+/* One node in a hundred is a turret and one in a hundred is hostile, every node
+ * has its own name, and one of the last ones is the target. In the wide tree all
+ * the nodes hang off the root; in the deep one each hangs off one of the 100
+ * before it, about 2000 levels deep.
+ */
+void bench_lookup_tree(std::mt19937& rng, bool deep) {
+    scene graph;
+    std::vector<std::unique_ptr<node>> tree(nodes);
+    int hostile = graph.lookup().tag("hostile");
+    std::uniform_int_distribution<int> percent(0, 99);
+    for (int i = 0; i < nodes; ++i) {
+        tree[i].reset(i > 0 && percent(rng) == 0 ? new turret(graph) : new node(graph));
+        tree[i]->set_name(i == nodes - 10 ? "target" : "n" + std::to_string(i));
+        if (percent(rng) == 0) {
+            tree[i]->add_tag(hostile);
+        }
+        if (i > 0) {
+            int parent = deep ? std::max(0, i - 1 - percent(rng)) : 0;
+            tree[parent]->add(tree[i].get());
+        }
+    }
+
+    const char* shape = deep ? "deep" : "wide";
+    char name[64];
+    std::vector<node*> found;
+    size_t counts[3];
+    double scans[3], lookups[3];
+    scans[0] = time_ns([&] { found.clear(); find_all(tree[0].get(), [](node* n) { return n->name() == "target"; }, found); });
+    counts[0] = found.size();
+    scans[1] = time_ns([&] { found.clear(); find_all(tree[0].get(), [=](node* n) { return n->has_tag(hostile); }, found); });
+    counts[1] = found.size();
+    scans[2] = time_ns([&] { found.clear(); find_all(tree[0].get(), [](node* n) { return dynamic_cast<turret*>(n) != nullptr; }, found); });
+    counts[2] = found.size();
+
+    // Each lookup visits what it finds, as the scan does.
+    auto visit = [](const std::vector<node*>& found) {
+        for (node* n : found) {
+            sink += (float)n->transform_id();
+        }
+    };
+    lookups[0] = time_ns([&] { visit(graph.lookup().named("target")); });
+    lookups[1] = time_ns([&] { visit(graph.lookup().tagged(hostile)); });
+    lookups[2] = time_ns([&] { visit(graph.lookup().of_type<turret>()); });
+    if (graph.lookup().named("target").size() != counts[0] || graph.lookup().tagged(hostile).size() != counts[1] || graph.lookup().of_type<turret>().size() != counts[2]) {
+        printf("lookup results differ from the scan\n");
+    }
+
+    const char* what[] = { "named", "tagged", "of type" };
+    for (int k = 0; k < 3; ++k) {
+        snprintf(name, sizeof(name), "%s %s, find scan", shape, what[k]);
+        report(name, scans[k]);
+        snprintf(name, sizeof(name), "%s %s, index (%d)", shape, what[k], (int)counts[k]);
+        printf("%-32s %10.3f us %8.0fx\n", name, lookups[k] * 1e-3, scans[k] / lookups[k]);
+    }
+
+    // Tearing the tree down takes every node back out of the index.
+    for (size_t i = tree.size(); i-- > 0;) {
+        tree[i].reset();
+    }
+    sink += (float)graph.lookup().tagged(hostile).size();
+}
+
+void bench_lookup(std::mt19937& rng) {
+    bench_lookup_tree(rng, false);
+    bench_lookup_tree(rng, true);
+}
+
+/* 200k boxes of 1 to 10 units scattered through a cube 4 km across, as ships and
+ * debris in a sector. Each query is timed on its own and reported per query.
+ */
+void bench_space(std::mt19937& rng) {
+    const int count = 200000;
+    std::uniform_real_distribution<float> d(-2000.0f, 2000.0f), size(0.5f, 5.0f), unit(-1.0f, 1.0f);
+    std::vector<aabb> boxes(count);
+    for (aabb& b : boxes) {
+        vec3 c{ d(rng), d(rng), d(rng) }, e{ size(rng), size(rng), size(rng) };
+        b = aabb{ c - e, c + e };
+    }
+
+    spatial_index<int> space(1.0f);
+    std::vector<int> ids(count);
+    auto start = std::chrono::high_resolution_clock::now();
+    for (int i = 0; i < count; ++i) {
+        ids[i] = space.insert(boxes[i], i);
+    }
+    auto end = std::chrono::high_resolution_clock::now();
+    report("spatial_index, insert 200k", std::chrono::duration<double, std::nano>(end - start).count(), count);
+    printf("%-32s %10d\n", "tree height", space.height());
+
+    report("rebuild", time_ns([&] { space.rebuild(); }), count);
+    job_system jobs;
+    char name[64];
+    snprintf(name, sizeof(name), "rebuild, %d thread%s", jobs.workers() + 1, jobs.workers() ? "s" : "");
+    report(name, time_ns([&] { space.rebuild(&jobs); }), count);
+    printf("%-32s %10d\n", "tree height", space.height());
+
+    // One in ten moving a little each frame, most staying inside their margin.
+    std::vector<int> movers;
+    for (int i = 0; i < count; i += 10) {
+        movers.push_back(i);
+    }
+    int moved = 0;
+    double move = time_ns([&] {
+        moved = 0;
+        for (int i : movers) {
+            vec3 v{ unit(rng), unit(rng), unit(rng) };
+            boxes[i].min += v * 0.3f;
+            boxes[i].max += v * 0.3f;
+            moved += space.move(ids[i], boxes[i]);
+        }
+    });
+    report("move 20k", move, (int)movers.size());
+    printf("%-32s %10d of %d\n", "reinserted", moved, (int)movers.size());
+
+    std::vector<int> found, brute(count);
+    found.reserve(count);
+    auto collect = [&found](int i) { found.push_back(i); };
+    mat4 vp = perspective_tan(std::tan(pi / 6), 16.0f / 9.0f, 1.0f, 1000.0f) * look_at(vec3(0.0f), vec3{ 1.0f, 0.2f, 0.3f }, vec3{ 0.0f, 1.0f, 0.0f });
+    frustum f = frustum::from_matrix(vp);
+    double tree = time_ns([&] { found.clear(); space.query(f, collect); });
+    int matched = 0;
+    double scan = time_ns([&] { matched = cull_boxes(f, boxes.data(), count, brute.data()); });
+    snprintf(name, sizeof(name), "frustum query (%d)", (int)found.size());
+    printf("%-32s %10.3f us\n", name, tree * 1e-3);
+    snprintf(name, sizeof(name), "cull_boxes over all (%d)", matched);
+    printf("%-32s %10.3f us\n", name, scan * 1e-3);
+
+    double ns = time_ns([&] { found.clear(); space.query(sphere{ vec3{ 100.0f, 0.0f, 0.0f }, 100.0f }, collect); });
+    snprintf(name, sizeof(name), "sphere query (%d)", (int)found.size());
+    printf("%-32s %10.3f us\n", name, ns * 1e-3);
+
+    ns = time_ns([&] { found.clear(); space.query(aabb{ vec3(-100.0f), vec3(100.0f) }, collect); });
+    snprintf(name, sizeof(name), "box query (%d)", (int)found.size());
+    printf("%-32s %10.3f us\n", name, ns * 1e-3);
+
+    int hit = -1;
+    float t = 0.0f;
+    ray r{ vec3{ -2000.0f, 3.0f, 5.0f }, vec3{ 1.0f, 0.01f, 0.02f }.normalized() };
+    ns = time_ns([&] { space.raycast(r, hit, t); });
+    printf("%-32s %10.3f us, hit at %.1f\n", "ray query", ns * 1e-3, t);
+
+    int nearest[16];
+    ns = time_ns([&] { sink += (float)space.nearest(vec3{ 10.0f, 20.0f, 30.0f }, 16, nearest); });
+    printf("%-32s %10.3f us\n", "16 nearest", ns * 1e-3);
+    sink += (float)(found.size() + hit);
+}
+
+/* Stands in for a model: drawing it costs about what setting up a draw call does. */
+class counted_node : public node {
+public:
+    using node::node;
+
+    bool draw_node(const render_state& rs) {
+        sink += world_matrix(rs).data[0];
+        return true;
+    }
+};
+
+/* How draw went before it was iterative: a virtual call per node, copying the
+ * render state down every level on the call stack.
+ */
+void draw_recursive(node* n, node::render_state rs) {
+    if (n->draw_node(rs)) {
+        n->find([&rs](node* c) {
+            draw_recursive(c, rs);
+            return false;
+        });
+    }
+}
+
+/* 100k nodes in the shape parent_of gives them, allocated in shuffled order,
+ * drawn by the recursion above and by the iterative node::draw.
+ */
+template <class Fn>
+void bench_traversal_shape(std::mt19937& rng, const char* shape, Fn parent_of) {
+    scene graph;
+    std::vector<int> order(nodes);
+    for (int i = 0; i < nodes; ++i) {
+        order[i] = i;
+    }
+    std::shuffle(order.begin(), order.end(), rng);
+
+    node root(graph);
+    std::vector<std::unique_ptr<counted_node>> tree(nodes);
+    for (int i : order) {
+        tree[i].reset(new counted_node(graph));
+    }
+    for (int i = 0; i < nodes; ++i) {
+        int p = parent_of(i);
+        (p < 0 ? &root : tree[p].get())->add(tree[i].get());
+    }
+    graph.transforms().update();
+
+    node::render_state rs = node::render_state();
+    char name[64];
+    double recursive = time_ns([&] {
+        root.find([&rs](node* c) {
+            draw_recursive(c, rs);
+            return false;
+        });
+    });
+    double iterative = time_ns([&] { root.draw(rs); });
+    snprintf(name, sizeof(name), "recursive draw, %s", shape);
+    report(name, recursive);
+    snprintf(name, sizeof(name), "iterative draw, %s", shape);
+    report(name, iterative);
+    printf("%-32s %10.2fx\n", "speedup", recursive / iterative);
+
+    int visited = 0;
+    double visit = time_ns([&] {
+        visited = 0;
+        root.traverse([&visited](node*) {
+            ++visited;
+            return true;
+        });
+    });
+    snprintf(name, sizeof(name), "traverse, %s", shape);
+    report(name, visit);
+    printf("%-32s %10d of %d\n", "nodes visited", visited, nodes);
+}
+
+/* Wide: every node under the root. Deep: 100 chains of 1000. Random: every node
+ * under a random earlier one.
+ */
+void bench_traversal(std::mt19937& rng) {
+    bench_traversal_shape(rng, "wide", [](int) { return -1; });
+    bench_traversal_shape(rng, "deep", [](int i) { return i % 1000 ? i - 1 : -1; });
+    bench_traversal_shape(rng, "random", [&rng](int i) { return i ? std::uniform_int_distribution<int>(0, i - 1)(rng) : -1; });
+}
+
+/* 100k bounded nodes in groups of 100 under bounded group nodes, drawn through a
+ * frustum that sees a small part of them, with and without culling.
+ */
+void bench_culling(std::mt19937& rng) {
+    scene graph;
+    std::uniform_real_distribution<float> d(-1000.0f, 1000.0f), offset(-20.0f, 20.0f);
+    node root(graph);
+    std::vector<std::unique_ptr<node>> groups(nodes / 100);
+    std::vector<std::unique_ptr<counted_node>> objects(nodes);
+    for (size_t g = 0; g < groups.size(); ++g) {
+        groups[g].reset(new node(graph));
+        groups[g]->set_local(affine3(vec3{ d(rng), d(rng), d(rng) }, quat()));
+        root.add(groups[g].get());
+    }
+    for (int i = 0; i < nodes; ++i) {
+        objects[i].reset(new counted_node(graph));
+        objects[i]->set_local(affine3(vec3{ offset(rng), offset(rng), offset(rng) }, quat()));
+        groups[i / 100]->add(objects[i].get());
+    }
+    graph.transforms().update();
+    for (size_t g = 0; g < groups.size(); ++g) {
+        groups[g]->set_bounds(aabb{ vec3(-21.0f), vec3(21.0f) });
+    }
+    for (auto& n : objects) {
+        n->set_bounds(aabb{ vec3(-1.0f), vec3(1.0f) });
+    }
+    graph.update_space();
+
+    node::render_state rs = node::render_state();
+    mat4 vp = perspective_tan(std::tan(pi / 6), 16.0f / 9.0f, 1.0f, 1000.0f) * look_at(vec3(0.0f), vec3{ 1.0f, 0.2f, 0.3f }, vec3{ 0.0f, 1.0f, 0.0f });
+    node::cull_state cull{ frustum::from_matrix(vp), node::cull_stats{ 0, 0, 0 } };
+
+    double all = time_ns([&] { root.draw(rs); });
+    rs.cull = &cull;
+    double culled = time_ns([&] { cull.stats = node::cull_stats{ 0, 0, 0 }; root.draw(rs); });
+    report("draw, culling off", all);
+    report("draw, culling on", culled);
+    printf("%-32s %10.2fx\n", "speedup", all / culled);
+    printf("%-32s %10d drawn, %d culled of %d tested\n", "last frame", cull.stats.drawn, cull.stats.culled, cull.stats.tested);
+
+    // A handful moving per tick: the bounds kept for culling cost as much as
+    // those, not the 100k bounded nodes.
+    float t = 0.0f;
+    double moving = 0.0;
+    for (int r = 0; r < repeats; ++r) {
+        t += 0.01f;
+        for (int i = 0; i < 10; ++i) {
+            objects[i * 997]->set_local(affine3(vec3{ std::sin(t + i), 0.0f, std::cos(t + i) } * 10.0f, quat()));
+        }
+        graph.transforms().update();
+        moving += time_ns([&graph] { graph.update_space(); }) / repeats;
+    }
+    report("update_space, 10 moving", moving, 10);
+}
+
+/* Ten seconds of frames from 2 to 40 ms apart, with a half second stall in the
+ * middle, fed to a 60 Hz fixed_timestep; and drawing 100k moving nodes between
+ * ticks, rewound halfway, against drawing them as of the last tick.
+ */
+void bench_timestep(std::mt19937& rng) {
+    scene graph;
+    std::uniform_real_distribution<double> frame(0.002, 0.040);
+    fixed_timestep timestep(60.0, 5);
+    double elapsed = 0.0;
+    int frames = 0;
+    bool stalled = false;
+    while (elapsed < 10.0) {
+        double t = frame(rng);
+        if (!stalled && elapsed > 5.0) {
+            t = 0.5;
+            stalled = true;
+        }
+        elapsed += t;
+        timestep.advance(t);
+        ++frames;
+    }
+    printf("%-32s %10lld run, %lld dropped, %d frames\n", "ticks in 10 s at 60 Hz", timestep.ticks(), timestep.ticks_dropped(), frames);
+
+    std::uniform_real_distribution<float> d(-1.0f, 1.0f);
+    node root(graph);
+    std::vector<std::unique_ptr<counted_node>> tree(nodes);
+    for (int i = 0; i < nodes; ++i) {
+        tree[i].reset(new counted_node(graph));
+        root.add(tree[i].get());
+    }
+    graph.transforms().update();
+    for (auto& n : tree) {
+        n->set_local(affine3(vec3{ d(rng), d(rng), d(rng) }, quat()));
+    }
+    graph.transforms().update();
+
+    node::render_state rs = node::render_state();
+    double last = time_ns([&] { root.draw(rs); });
+    rs.rewind = 0.5f;
+    double between = time_ns([&] { root.draw(rs); });
+    report("draw, last tick", last);
+    report("draw, between ticks", between);
+}
+
+/* Render queue keys for 100k draws: 4 programs, 200 mesh parts and random depths,
+ * submitted in scene order, sorted by radix_sort and by std::sort.
+ */
+void bench_sort(std::mt19937& rng) {
+    std::uniform_int_distribution<int> program(0, 3), part(0, 199);
+    std::uniform_real_distribution<float> depth(1.0f, 1000.0f);
+    std::vector<sort_key> keys(nodes), sorted(nodes), scratch(nodes);
+    for (int i = 0; i < nodes; ++i) {
+        float z = depth(rng);
+        uint32_t bits;
+        std::memcpy(&bits, &z, sizeof(bits));
+        keys[i] = sort_key{ uint64_t(program(rng)) << 48 | uint64_t(part(rng)) << 24 | bits >> 8, (uint32_t)i };
+    }
+
+    double radix = time_ns([&] { sorted = keys; radix_sort(sorted.data(), scratch.data(), nodes); });
+    std::vector<sort_key> check = keys;
+    double comparison = time_ns([&] {
+        check = keys;
+        std::stable_sort(check.begin(), check.end(), [](const sort_key& a, const sort_key& b) { return a.key < b.key; });
+    });
+    report("radix_sort, 100k keys", radix);
+    report("std::stable_sort", comparison);
+    printf("%-32s %10.2fx\n", "speedup", comparison / radix);
+
+    int mismatches = 0;
+    for (int i = 0; i < nodes; ++i) {
+        mismatches += sorted[i].index != check[i].index;
+    }
+    printf("%-32s %10d\n", "order mismatches", mismatches);
+    sink += (float)mismatches;
+
+    // Two draws of one program and mesh part, 50 and 5 units in front of a
+    // camera looking down -x, submitted far first: the near one is drawn first.
+    // The keys are built the way render_queue::submit builds them, as submit
+    // itself needs a GL context.
+    mat4 view = look_at(vec3{ 3.0f, 1.0f, 2.0f }, vec3{ -1.0f, 1.0f, 2.0f }, vec3{ 0.0f, 1.0f, 0.0f });
+    mat4 far_world = translate(-47.0f, 1.0f, 2.0f), near_world = translate(-2.0f, 1.0f, 2.0f);
+    sort_key draws[2] = {
+        { render_queue::opaque_key(0, 0, render_queue::depth_bits(view, far_world)), 0 },
+        { render_queue::opaque_key(0, 0, render_queue::depth_bits(view, near_world)), 1 },
+    }, draw_scratch[2];
+    radix_sort(draws, draw_scratch, 2);
+    if (draws[0].index != 1 || draws[0].key == draws[1].key) {
+        fprintf(stderr, "render_queue: opaque draws not sorted nearest first\n");
+        ++failures;
+    }
+}
+
+int main() {
+    std::mt19937 rng(1234);
+
+    printf("scene_bench: %d nodes, %d repeats, simd=%s\n", nodes, repeats, simd::name);
+
+    bench_hierarchy(rng);
+    bench_parallel_update(rng);
+    bench_sleep(rng);
+    bench_pipeline(rng);
+    bench_entities(rng);
+    bench_despawn(rng);
+    bench_lookup(rng);
+    bench_space(rng);
+    bench_traversal(rng);
+    bench_culling(rng);
+    bench_sort(rng);
+    bench_timestep(rng);
+
+    return failures > 0 || sink == 1.0f ? 1 : 0;
+}